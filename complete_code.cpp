@@ -6,6 +6,45 @@
 #include <algorithm>
 #include <memory>
 #include <limits>
+#include <unordered_map>
+#include <unordered_set>
+#include <map>
+#include <set>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <string_view>
+#include <charconv>
+#include <sstream>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <list>
+#include <queue>
+#include <tuple>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <iomanip>
+#include <cmath>
+#include <cerrno>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <csignal>
+#include <pwd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
 
 using namespace std;
 
@@ -20,668 +59,5981 @@ class BorrowRecord;
 const int MAX_BOOKS = 1000;
 const double DAILY_FINE = 0.50;
 const int BORROW_DAYS = 14;
+const size_t NO_RECORD = static_cast<size_t>(-1); // Record id returned when nothing was issued
+const char* const SNAPSHOT_FILE = "library.snap";
+const char* const JOURNAL_FILE = "library.journal";
+const char* const METRICS_FILE = "metrics.prom";
+const char* const OVERDUE_FILE = "overdue.txt";
+const char* const ARCHIVE_FILE = "library.archive";
+const int ARCHIVE_AFTER_DAYS = 365; // Default age of a return before its loan may move to the archive
+const uint64_t JOURNAL_COMPACT_BYTES = 64ull << 20; // Fold the journal into a full save past this size
 
 // Utility functions
 time_t getCurrentTime() {
     return time(nullptr);
 }
 
-string timeToString(time_t time) {
-    char buffer[80];
-    tm* timeinfo = localtime(&time);
-    strftime(buffer, 80, "%Y-%m-%d %H:%M:%S", timeinfo);
-    return string(buffer);
+// Start of the next day in local time
+time_t nextMidnight(time_t time) {
+    tm day = *localtime(&time);
+    day.tm_mday++;
+    day.tm_hour = 0;
+    day.tm_min = 0;
+    day.tm_sec = 0;
+    day.tm_isdst = -1;
+    return mktime(&day);
 }
 
-// Abstract base class for User
-class User {
-protected:
-    string username;
-    string password;
-    string name;
-    string email;
-    static int totalUsers; // Static data member
+// DateFormatter class: formats times as "YYYY-MM-DD HH:MM:SS" without a localtime
+// call per time. The date text and bounds of recently seen local days are cached,
+// so a time on one of those days takes a little arithmetic. Days with a DST change
+// are not cached.
+class DateFormatter {
+private:
+    static const time_t DAY = 24 * 60 * 60;
+    static const size_t SLOTS = 64; // Cached days, direct-mapped by day number
+
+    struct Day {
+        time_t start = 1; // First second of the day; start > end marks an empty slot
+        time_t end = 0;   // First second of the next day
+        char date[16];
+    };
+    Day days[SLOTS];
+
+    // Fills day with the local day containing time; false if it is not a plain 24 hours
+    static bool fill(Day& day, time_t time) {
+        tm local = *localtime(&time);
+        char date[sizeof(day.date)];
+        if (strftime(date, sizeof(date), "%Y-%m-%d", &local) != 10) {
+            return false;
+        }
+        tm midnight = local;
+        midnight.tm_hour = 0;
+        midnight.tm_min = 0;
+        midnight.tm_sec = 0;
+        midnight.tm_isdst = -1;
+        time_t start = mktime(&midnight);
+        time_t end = nextMidnight(time);
+        if (end - start != DAY || time < start || time >= end) {
+            return false;
+        }
+        day.start = start;
+        day.end = end;
+        memcpy(day.date, date, sizeof(date));
+        return true;
+    }
+
+    static void twoDigits(char* out, time_t value) {
+        out[0] = static_cast<char>('0' + value / 10);
+        out[1] = static_cast<char>('0' + value % 10);
+    }
 
 public:
-    User(const string& uname, const string& pwd, const string& n, const string& e)
-        : username(uname), password(pwd), name(n), email(e) {
-        totalUsers++;
+    static const size_t MAX_LENGTH = 32;
+
+    // Writes the time to out (at least MAX_LENGTH bytes) and returns its length
+    size_t format(time_t time, char* out) {
+        Day& day = days[static_cast<uint64_t>(time) / DAY % SLOTS];
+        if ((time < day.start || time >= day.end) && !fill(day, time)) {
+            tm* timeinfo = localtime(&time);
+            return strftime(out, MAX_LENGTH, "%Y-%m-%d %H:%M:%S", timeinfo);
+        }
+        time_t seconds = time - day.start;
+        memcpy(out, day.date, 10);
+        out[10] = ' ';
+        twoDigits(out + 11, seconds / 3600);
+        out[13] = ':';
+        twoDigits(out + 14, seconds / 60 % 60);
+        out[16] = ':';
+        twoDigits(out + 17, seconds % 60);
+        return 19;
     }
 
-    // Pure virtual function making this an abstract class
-    virtual void displayDashboard() = 0;
+    string format(time_t time) {
+        char buffer[MAX_LENGTH];
+        return string(buffer, format(time, buffer));
+    }
+};
 
-    // Virtual destructor
-    virtual ~User() {
-        totalUsers--;
+string timeToString(time_t time) {
+    thread_local DateFormatter formatter;
+    return formatter.format(time);
+}
+
+// Renderer class: buffered text output for listings. Text collects in a buffer that
+// goes out in large writes, never per line, to a stream or to a file descriptor such
+// as a file or socket. Dates are formatted through a DateFormatter.
+class Renderer {
+private:
+    static const size_t FLUSH_BYTES = 64 << 10;
+
+    ostream* stream;
+    int fd;
+    string buffer;
+    DateFormatter dates;
+
+    void spill() {
+        if (buffer.size() >= FLUSH_BYTES) {
+            flush();
+        }
     }
 
-    // Static member function
-    static int getTotalUsers() {
-        return totalUsers;
+public:
+    explicit Renderer(ostream& out) : stream(&out), fd(-1) { buffer.reserve(FLUSH_BYTES + 4096); }
+    explicit Renderer(int descriptor) : stream(nullptr), fd(descriptor) { buffer.reserve(FLUSH_BYTES + 4096); }
+    ~Renderer() { flush(); }
+
+    Renderer(const Renderer&) = delete;
+    Renderer& operator=(const Renderer&) = delete;
+
+    Renderer& operator<<(string_view text) {
+        buffer.append(text.data(), text.size());
+        spill();
+        return *this;
     }
 
-    // Getters with const
-    string getUsername() const { return username; }
-    string getName() const { return name; }
-    string getEmail() const { return email; }
+    Renderer& operator<<(char c) {
+        buffer.push_back(c);
+        spill();
+        return *this;
+    }
 
-    // Friend function declaration
-    friend void displayUserInfo(const User& user);
+    template <typename Integer, typename = enable_if_t<is_integral<Integer>::value>>
+    Renderer& operator<<(Integer value) {
+        char digits[24];
+        buffer.append(digits, to_chars(digits, digits + sizeof(digits), value).ptr);
+        spill();
+        return *this;
+    }
 
-protected:
-    // Protected method for derived classes
-    void changePassword(const string& newPassword) {
-        password = newPassword;
+    // Writes a time as timeToString does
+    Renderer& date(time_t time) {
+        char text[DateFormatter::MAX_LENGTH];
+        buffer.append(text, dates.format(time, text));
+        spill();
+        return *this;
     }
-};
 
-int User::totalUsers = 0;
+    // Writes an amount as fixed-point dollars, "$1.50"
+    Renderer& money(double amount) {
+        int64_t cents = llround(amount * 100);
+        *this << '$' << cents / 100 << '.' << static_cast<char>('0' + cents % 100 / 10)
+              << static_cast<char>('0' + cents % 10);
+        return *this;
+    }
 
-// Friend function definition
-void displayUserInfo(const User& user) {
-    cout << "User Info (via friend function):" << endl;
-    cout << "Username: " << user.username << endl;
-    cout << "Name: " << user.name << endl;
-    cout << "Email: " << user.email << endl;
-}
+    // Writes out everything buffered so far
+    void flush() {
+        if (buffer.empty()) {
+            return;
+        }
+        if (stream != nullptr) {
+            stream->write(buffer.data(), buffer.size());
+        }
+#ifndef _WIN32
+        else {
+            size_t sent = 0;
+            while (sent < buffer.size()) {
+                ssize_t n = write(fd, buffer.data() + sent, buffer.size() - sent);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    break; // The reader went away; drop the rest
+                }
+                sent += static_cast<size_t>(n);
+            }
+        }
+#endif
+        buffer.clear();
+    }
+};
 
-// Book class
-class Book {
+// MappedFile class: read-only view of a whole file, memory-mapped where the platform allows
+class MappedFile {
 private:
-    string title;
-    string author;
-    string isbn;
-    string genre;
-    int totalCopies;
-    int availableCopies;
-    static int totalBooks; // Static data member
+    const char* bytes;
+    size_t length;
+    bool mapped;
+    string fallback; // Holds the contents when mmap is unavailable
 
 public:
-    // Constructor overloading
-    Book() : title(""), author(""), isbn(""), genre(""), totalCopies(0), availableCopies(0) {}
-    Book(const string& t, const string& a, const string& i, const string& g, int copies)
-        : title(t), author(a), isbn(i), genre(g), totalCopies(copies), availableCopies(copies) {
-        totalBooks++;
+    explicit MappedFile(const string& path) : bytes(nullptr), length(0), mapped(false) {
+#ifndef _WIN32
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            void* addr = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED) {
+                madvise(addr, info.st_size, MADV_SEQUENTIAL);
+                bytes = static_cast<const char*>(addr);
+                length = info.st_size;
+                mapped = true;
+            }
+        }
+        close(fd);
+        if (mapped) {
+            return;
+        }
+#endif
+        ifstream file(path, ios::binary);
+        fallback.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+        bytes = fallback.data();
+        length = fallback.size();
     }
 
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
     // Destructor
-    ~Book() {
-        totalBooks--;
+    ~MappedFile() {
+#ifndef _WIN32
+        if (mapped) {
+            munmap(const_cast<char*>(bytes), length);
+        }
+#endif
     }
 
-    // Static member function
-    static int getTotalBooks() {
-        return totalBooks;
+    string_view view() const { return string_view(bytes, length); }
+};
+
+// Calls fn(line) for every line of text, without copying; a trailing '\r' is dropped
+template <typename Fn>
+void forEachLine(string_view text, Fn fn) {
+    while (!text.empty()) {
+        const char* nl = static_cast<const char*>(memchr(text.data(), '\n', text.size()));
+        size_t len = nl != nullptr ? static_cast<size_t>(nl - text.data()) : text.size();
+        string_view line = text.substr(0, len);
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+        fn(line);
+        text.remove_prefix(nl != nullptr ? len + 1 : len);
     }
+}
 
-    // Getters with const
-    string getTitle() const { return title; }
-    string getAuthor() const { return author; }
-    string getIsbn() const { return isbn; }
-    string getGenre() const { return genre; }
-    int getTotalCopies() const { return totalCopies; }
-    int getAvailableCopies() const { return availableCopies; }
+// Slices a line into comma-separated fields. Returns the number of fields in the line,
+// which may exceed maxFields; only the first maxFields are stored.
+size_t splitFields(string_view line, string_view* fields, size_t maxFields) {
+    size_t count = 0;
+    while (true) {
+        size_t pos = line.find(',');
+        if (count < maxFields) {
+            fields[count] = line.substr(0, pos);
+        }
+        count++;
+        if (pos == string_view::npos) {
+            return count;
+        }
+        line.remove_prefix(pos + 1);
+    }
+}
 
-    // Setters
-    void setTitle(const string& t) { title = t; }
-    void setAuthor(const string& a) { author = a; }
-    void setGenre(const string& g) { genre = g; }
-    void setTotalCopies(int copies) {
-        totalCopies = copies;
-        availableCopies += (copies - totalCopies);
+// Parses a whole field as an integer; false if it is empty, malformed or has trailing junk
+template <typename T>
+bool parseNumber(string_view field, T& value) {
+    const char* end = field.data() + field.size();
+    auto result = from_chars(field.data(), end, value);
+    return result.ec == errc() && result.ptr == end && !field.empty();
+}
+
+// Cuts text into pieces of about chunkBytes each, ending on line boundaries, so the
+// pieces can be parsed independently and their lines still come out in order
+vector<string_view> splitChunks(string_view text, size_t chunkBytes) {
+    vector<string_view> chunks;
+    while (!text.empty()) {
+        size_t end = text.size();
+        if (chunkBytes < text.size()) {
+            size_t nl = text.find('\n', chunkBytes);
+            end = nl != string_view::npos ? nl + 1 : text.size();
+        }
+        chunks.push_back(text.substr(0, end));
+        text.remove_prefix(end);
     }
+    return chunks;
+}
 
-    // Member functions
-    void borrowCopy() {
-        if (availableCopies > 0) {
-            availableCopies--;
+// ThreadPool class: a fixed set of worker threads running submitted tasks in submission
+// order. wait() blocks until every task submitted so far has finished.
+class ThreadPool {
+private:
+    vector<thread> workers;
+    deque<function<void()>> tasks;
+    mutex lock;
+    condition_variable taskReady;
+    condition_variable allDone;
+    size_t running = 0; // Tasks taken off the queue and not yet finished
+    bool stopping = false;
+
+    void work() {
+        unique_lock<mutex> guard(lock);
+        while (true) {
+            taskReady.wait(guard, [this]() { return stopping || !tasks.empty(); });
+            if (tasks.empty()) {
+                return; // Stopping, and nothing left to run
+            }
+            function<void()> task = move(tasks.front());
+            tasks.pop_front();
+            running++;
+            guard.unlock();
+            task();
+            guard.lock();
+            running--;
+            if (tasks.empty() && running == 0) {
+                allDone.notify_all();
+            }
         }
     }
 
-    void returnCopy() {
-        if (availableCopies < totalCopies) {
-            availableCopies++;
+public:
+    explicit ThreadPool(unsigned threads) {
+        for (unsigned i = 0; i < max(1u, threads); i++) {
+            workers.emplace_back([this]() { work(); });
+        }
+    }
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Finishes the queued tasks, then stops the workers
+    ~ThreadPool() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        taskReady.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
         }
     }
 
-    // Operator overloading
-    bool operator==(const Book& other) const {
-        return isbn == other.isbn;
+    void submit(function<void()> task) {
+        {
+            lock_guard<mutex> guard(lock);
+            tasks.push_back(move(task));
+        }
+        taskReady.notify_one();
     }
 
-    // Display book info
-    void display() const {
-        cout << "Title: " << title << "\nAuthor: " << author
-             << "\nISBN: " << isbn << "\nGenre: " << genre
-             << "\nCopies: " << availableCopies << "/" << totalCopies << endl;
+    void wait() {
+        unique_lock<mutex> guard(lock);
+        allDone.wait(guard, [this]() { return tasks.empty() && running == 0; });
     }
+
+    size_t size() const { return workers.size(); }
 };
 
-int Book::totalBooks = 0;
+// LockStripes class: a map split into stripes by key hash, each behind its own
+// reader/writer lock, so concurrent lookups of different keys rarely share a lock.
+// Callers lock the stripe they use: shared to read, unique to change it.
+template <typename Map, typename Hash = std::hash<string_view>>
+class LockStripes {
+public:
+    static const size_t COUNT = 64;
+
+    struct alignas(64) Stripe {
+        mutable shared_mutex lock;
+        Map map;
+    };
 
-// BorrowRecord class
-class Fine {
 private:
-    double amount;
-    time_t daysOverdue;
+    Stripe stripes[COUNT];
 
 public:
-    Fine(time_t secondsOverdue) {
-        daysOverdue = secondsOverdue / (24 * 60 * 60);
-        amount = daysOverdue * DAILY_FINE;
-    }
+    Stripe& of(string_view key) { return stripes[Hash()(key) % COUNT]; }
+    const Stripe& of(string_view key) const { return stripes[Hash()(key) % COUNT]; }
 
-    // Getters with const
-    double getAmount() const { return amount; }
-    time_t getDaysOverdue() const { return daysOverdue; }
-
-    // Pay fine
-    void payFine(double payment) {
-        amount -= payment;
-        if (amount < 0) amount = 0;
-    }
+    // Iteration over every stripe, for clearing
+    Stripe* begin() { return stripes; }
+    Stripe* end() { return stripes + COUNT; }
 };
-class BorrowRecord {
-private:
-    string userId;
-    string bookIsbn;
-    time_t borrowDate;
-    time_t dueDate;
-    time_t returnDate;
-    bool returned;
-    Fine* fine; // Association
 
+// Operations whose latency is recorded
+enum class Operation : uint8_t { Login, Search, Issue, Return, Save, Load, FineAccrual, Complete, FuzzySearch };
+const size_t OPERATION_COUNT = 9;
+
+const char* operationName(Operation op) {
+    static const char* const NAMES[OPERATION_COUNT] = {"login", "search", "issue", "return", "save", "load",
+                                                       "fine_accrual", "complete", "fuzzy_search"};
+    return NAMES[static_cast<size_t>(op)];
+}
+
+// Metrics class: a counter, a failure counter and a latency histogram per operation.
+// Histogram bucket b counts latencies under 2^b nanoseconds (the last bucket takes the
+// rest). Every thread records into a shard of its own, so recording is a handful of
+// uncontended relaxed stores; readers add up the shards. A shard is handed on to the
+// next thread when its thread exits, and its counts are kept.
+class Metrics {
 public:
-    BorrowRecord(const string& uid, const string& isbn, time_t bDate)
-        : userId(uid), bookIsbn(isbn), borrowDate(bDate),
-          dueDate(bDate + (BORROW_DAYS * 24 * 60 * 60)),
-          returned(false), fine(nullptr) {}
+    static const size_t BUCKETS = 40;
 
-    // Destructor
-    ~BorrowRecord() {
-        if (fine != nullptr) {
-            delete fine;
+    // Sum over all shards for one operation
+    struct Totals {
+        uint64_t count = 0, failed = 0, nanos = 0;
+        uint64_t buckets[BUCKETS] = {};
+
+        // Upper bound in nanoseconds of the bucket holding the given fraction of operations
+        uint64_t percentile(double fraction) const {
+            if (count == 0) {
+                return 0;
+            }
+            uint64_t rank = static_cast<uint64_t>(fraction * count), seen = 0;
+            for (size_t b = 0; b < BUCKETS; b++) {
+                seen += buckets[b];
+                if (seen > rank) {
+                    return 1ull << b;
+                }
+            }
+            return 1ull << (BUCKETS - 1);
         }
+    };
+
+private:
+    struct alignas(64) Shard {
+        atomic<uint64_t> count[OPERATION_COUNT], failed[OPERATION_COUNT], nanos[OPERATION_COUNT];
+        atomic<uint64_t> buckets[OPERATION_COUNT][BUCKETS];
+        bool inUse = false;
+    };
+
+    // Claims a shard for the thread that owns it and gives it back when the thread exits
+    struct ShardHandle {
+        Shard* shard;
+        ShardHandle() : shard(Metrics::getInstance().acquire()) {}
+        ~ShardHandle() { Metrics::getInstance().release(shard); }
+    };
+
+    mutable mutex shardLock;
+    vector<unique_ptr<Shard>> shards;
+
+    Metrics() {}
+
+    Shard* acquire() {
+        lock_guard<mutex> guard(shardLock);
+        for (auto& shard : shards) {
+            if (!shard->inUse) {
+                shard->inUse = true;
+                return shard.get();
+            }
+        }
+        shards.emplace_back(new Shard()); // Value-initialized: all counts zero
+        shards.back()->inUse = true;
+        return shards.back().get();
     }
 
-    // Getters with const
-    string getUserId() const { return userId; }
-    string getBookIsbn() const { return bookIsbn; }
-    time_t getBorrowDate() const { return borrowDate; }
-    time_t getDueDate() const { return dueDate; }
-    time_t getReturnDate() const { return returnDate; }
-    bool isReturned() const { return returned; }
-    Fine* getFine() const { return fine; }
+    void release(Shard* shard) {
+        lock_guard<mutex> guard(shardLock);
+        shard->inUse = false;
+    }
+
+    // Only the owning thread writes a shard, so no read-modify-write is needed
+    static void bump(atomic<uint64_t>& counter, uint64_t amount = 1) {
+        counter.store(counter.load(memory_order_relaxed) + amount, memory_order_relaxed);
+    }
+
+public:
+    static Metrics& getInstance() {
+        static Metrics instance;
+        return instance;
+    }
 
-    // Return the book
-    void returnBook(time_t rDate) {
-        returnDate = rDate;
-        returned = true;
-        if (returnDate > dueDate) {
-            // Create fine if returned late
-            fine = new Fine(returnDate - dueDate);
+    void record(Operation op, uint64_t nanos, bool succeeded) {
+        static thread_local ShardHandle local;
+        Shard& shard = *local.shard;
+        size_t i = static_cast<size_t>(op), bucket = 0;
+        while (bucket + 1 < BUCKETS && (nanos >> bucket) != 0) {
+            bucket++;
+        }
+        bump(shard.count[i]);
+        bump(shard.nanos[i], nanos);
+        bump(shard.buckets[i][bucket]);
+        if (!succeeded) {
+            bump(shard.failed[i]);
         }
     }
 
-    // Display record
-    void display() const {
-        cout << "User ID: " << userId << "\nBook ISBN: " << bookIsbn
-             << "\nBorrowed: " << timeToString(borrowDate)
-             << "\nDue: " << timeToString(dueDate);
-        if (returned) {
-            cout << "\nReturned: " << timeToString(returnDate);
-            if (fine != nullptr) {
-                cout << "\nFine: $" << fine->getAmount();
+    Totals totals(Operation op) const {
+        Totals sum;
+        size_t i = static_cast<size_t>(op);
+        lock_guard<mutex> guard(shardLock);
+        for (const auto& shard : shards) {
+            sum.count += shard->count[i].load(memory_order_relaxed);
+            sum.failed += shard->failed[i].load(memory_order_relaxed);
+            sum.nanos += shard->nanos[i].load(memory_order_relaxed);
+            for (size_t b = 0; b < BUCKETS; b++) {
+                sum.buckets[b] += shard->buckets[i][b].load(memory_order_relaxed);
             }
-        } else {
-            cout << "\nStatus: Not returned";
-            if (getCurrentTime() > dueDate) {
-                cout << "\nOverdue by " << (getCurrentTime() - dueDate) / (24 * 60 * 60) << " days";
+        }
+        return sum;
+    }
+
+    // Writes every counter and histogram in the Prometheus text exposition format
+    void dump(ostream& out) const {
+        out << "# TYPE lms_operations_failed_total counter\n";
+        for (size_t i = 0; i < OPERATION_COUNT; i++) {
+            out << "lms_operations_failed_total{op=\"" << operationName(Operation(i)) << "\"} "
+                << totals(Operation(i)).failed << "\n";
+        }
+        out << "# TYPE lms_operation_seconds histogram\n";
+        for (size_t i = 0; i < OPERATION_COUNT; i++) {
+            Totals sum = totals(Operation(i));
+            const char* name = operationName(Operation(i));
+            uint64_t cumulative = 0;
+            for (size_t b = 0; b + 1 < BUCKETS; b++) {
+                cumulative += sum.buckets[b];
+                out << "lms_operation_seconds_bucket{op=\"" << name << "\",le=\"" << (1ull << b) / 1e9 << "\"} "
+                    << cumulative << "\n";
             }
+            out << "lms_operation_seconds_bucket{op=\"" << name << "\",le=\"+Inf\"} " << sum.count << "\n";
+            out << "lms_operation_seconds_sum{op=\"" << name << "\"} " << sum.nanos / 1e9 << "\n";
+            out << "lms_operation_seconds_count{op=\"" << name << "\"} " << sum.count << "\n";
         }
-        cout << endl;
     }
 };
 
-// Fine class
+// Records the time from construction to destruction as one operation;
+// call fail() if the operation did not succeed
+class OperationTimer {
+private:
+    Operation op;
+    chrono::steady_clock::time_point start;
+    bool succeeded;
 
+public:
+    explicit OperationTimer(Operation o) : op(o), start(chrono::steady_clock::now()), succeeded(true) {}
 
-// User derived classes
-class Admin : public User {
+    ~OperationTimer() {
+        auto elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start);
+        Metrics::getInstance().record(op, static_cast<uint64_t>(elapsed.count()), succeeded);
+    }
+
+    void fail() {
+        succeeded = false;
+    }
+};
+
+// Circulation and catalog events recorded in the write-ahead journal
+enum class JournalOp : uint8_t { Issue = 1, Return, AddBook, EditBook, DeleteBook, AddUser, RemoveUser };
+
+// One journal entry: an operation plus its string and numeric arguments in op-specific order
+struct JournalEntry {
+    JournalOp op;
+    vector<string> text;
+    vector<int64_t> numbers;
+};
+
+// Journal class: append-only log of every mutation since the last full save.
+// Entries are buffered by append() and made durable together by commit(), so
+// one fsync covers every mutation made since the previous commit.
+// Each entry is framed as [u32 body length][u32 FNV-1a checksum][body].
+// Safe to use from several threads: entries are encoded outside any lock, and a
+// commit writes while new entries keep queueing behind it.
+class Journal {
 private:
-    static Admin* instance; // For Singleton pattern
+    FILE* file;
+    list<string> pending; // Encoded entries not yet written
+    atomic<uint64_t> bytesWritten;
+    mutex pendingLock; // Guards pending
+    mutex fileLock;    // Guards file and keeps commits in order
+
+    template <typename T>
+    static void put(string& out, T value) {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
 
-    // Private constructor for Singleton
-    Admin(const string& uname, const string& pwd, const string& n, const string& e)
-        : User(uname, pwd, n, e) {}
+    template <typename T>
+    static bool get(string_view& in, T& value) {
+        if (in.size() < sizeof(value)) {
+            return false;
+        }
+        memcpy(&value, in.data(), sizeof(value));
+        in.remove_prefix(sizeof(value));
+        return true;
+    }
 
-public:
-    // Singleton implementation
-    static Admin* getInstance(const string& uname, const string& pwd,
-                             const string& n, const string& e) {
-        if (instance == nullptr) {
-            instance = new Admin(uname, pwd, n, e);
+    static bool decode(string_view body, JournalEntry& entry) {
+        uint8_t op, textCount, numberCount;
+        if (!get(body, op) || !get(body, textCount)) {
+            return false;
+        }
+        entry.op = static_cast<JournalOp>(op);
+        entry.text.clear();
+        entry.numbers.clear();
+        for (uint8_t i = 0; i < textCount; i++) {
+            uint32_t len;
+            if (!get(body, len) || body.size() < len) {
+                return false;
+            }
+            entry.text.emplace_back(body.data(), len);
+            body.remove_prefix(len);
+        }
+        if (!get(body, numberCount)) {
+            return false;
+        }
+        for (uint8_t i = 0; i < numberCount; i++) {
+            int64_t value;
+            if (!get(body, value)) {
+                return false;
+            }
+            entry.numbers.push_back(value);
+        }
+        return body.empty();
+    }
+
+    // Takes the pending entries and writes them; the caller holds fileLock, so batches
+    // reach the file in the order they were taken
+    bool commitLocked() {
+        list<string> batch;
+        {
+            lock_guard<mutex> guard(pendingLock);
+            batch.swap(pending);
+        }
+        if (file == nullptr || batch.empty()) {
+            return true;
+        }
+        bool ok = true;
+        uint64_t bytes = 0;
+        for (const string& frame : batch) {
+            ok = ok && fwrite(frame.data(), 1, frame.size(), file) == frame.size();
+            bytes += frame.size();
+        }
+        ok = ok && fflush(file) == 0;
+        if (ok) {
+            bytesWritten += bytes; // Only bytes the file accepted count towards compaction
+        }
+#ifndef _WIN32
+        ok = ok && fdatasync(fileno(file)) == 0;
+#endif
+        return ok;
+    }
+
+    void closeLocked() {
+        if (file != nullptr) {
+            commitLocked();
+            fclose(file);
+            file = nullptr;
         }
-        return instance;
     }
 
+public:
+    Journal() : file(nullptr), bytesWritten(0) {}
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
     // Destructor
-    ~Admin() {
-        instance = nullptr;
+    ~Journal() {
+        close();
     }
 
-    // Function overriding
-    void displayDashboard() override {
-        cout << "\n=== ADMIN DASHBOARD ===\n";
-        cout << "Welcome, " << name << "!\n";
-        cout << "1. Manage Users\n2. Generate Reports\n3. System Settings\n4. Logout\n";
+    // FNV-1a checksum of an entry body; the record archive checks its segments with it too
+    static uint32_t checksum(const char* data, size_t size) {
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < size; i++) {
+            hash = (hash ^ static_cast<unsigned char>(data[i])) * 16777619u;
+        }
+        return hash;
     }
 
-    // Admin specific functions
-    void addUser(vector<User*>& users, User* newUser) {
-        users.push_back(newUser);
+    bool open(const string& path) {
+        lock_guard<mutex> guard(fileLock);
+        closeLocked();
+        file = fopen(path.c_str(), "ab");
+        if (file == nullptr) {
+            return false;
+        }
+        fseek(file, 0, SEEK_END);
+        bytesWritten = ftell(file);
+        return true;
+    }
+
+    void close() {
+        lock_guard<mutex> guard(fileLock);
+        closeLocked();
+    }
+
+    bool isOpen() {
+        lock_guard<mutex> guard(fileLock);
+        return file != nullptr;
     }
 
-    void removeUser(vector<User*>& users, const string& username) {
-        auto it = find_if(users.begin(), users.end(),
-            [&username](User* u) { return u->getUsername() == username; });
-        if (it != users.end()) {
-            delete *it; // Free memory
-            users.erase(it);
+    // Size of the journal on disk, used to decide when to compact
+    uint64_t size() const { return bytesWritten; }
+
+    // An encoded entry. Appending one only links it in and cannot throw, so a writer
+    // that must not fail part-way encodes its entry up front (see RecordStore::add).
+    typedef list<string> Frame;
+
+    static Frame encode(const JournalEntry& entry) {
+        string body;
+        put(body, static_cast<uint8_t>(entry.op));
+        put(body, static_cast<uint8_t>(entry.text.size()));
+        for (const auto& s : entry.text) {
+            put(body, static_cast<uint32_t>(s.size()));
+            body += s;
+        }
+        put(body, static_cast<uint8_t>(entry.numbers.size()));
+        for (int64_t n : entry.numbers) {
+            put(body, n);
         }
+        uint32_t header[2] = {static_cast<uint32_t>(body.size()), checksum(body.data(), body.size())};
+        Frame frame(1);
+        frame.front().reserve(sizeof(header) + body.size());
+        frame.front().append(reinterpret_cast<const char*>(header), sizeof(header));
+        frame.front() += body;
+        return frame;
+    }
+
+    // Takes the frame's entry, leaving the frame empty
+    void append(Frame& frame) {
+        lock_guard<mutex> guard(pendingLock);
+        pending.splice(pending.end(), frame);
+    }
+
+    void append(const JournalEntry& entry) {
+        Frame frame = encode(entry);
+        append(frame);
+    }
+
+    // Writes every pending entry and waits for it to reach the disk
+    bool commit() {
+        lock_guard<mutex> guard(fileLock);
+        return commitLocked();
     }
 
-    void generateReport(const vector<Book*>& books, const vector<BorrowRecord*>& records) {
-        cout << "\n=== LIBRARY REPORT ===\n";
-        cout << "Total Books: " << Book::getTotalBooks() << endl;
-        cout << "Total Users: " << User::getTotalUsers() << endl;
+    // Discards the journal once its contents are folded into a full save
+    void reset(const string& path) {
+        lock_guard<mutex> guard(fileLock);
+        {
+            lock_guard<mutex> pendingGuard(pendingLock);
+            pending.clear();
+        }
+        closeLocked();
+        FILE* truncated = fopen(path.c_str(), "wb");
+        if (truncated != nullptr) {
+            fclose(truncated);
+        }
+        file = fopen(path.c_str(), "ab");
+        bytesWritten = 0;
+    }
 
-        int overdue = count_if(records.begin(), records.end(),
-            [](BorrowRecord* r) { return !r->isReturned() && getCurrentTime() > r->getDueDate(); });
-        cout << "Overdue Books: " << overdue << endl;
+    // Calls apply(entry) for every intact entry in the journal at path. Replay stops at the
+    // first torn or corrupt entry (a crash mid-write), which is cut off so new entries follow
+    // the last good one. Returns the number of entries replayed.
+    template <typename Fn>
+    static size_t replay(const string& path, Fn apply) {
+        size_t count = 0;
+        uint64_t goodBytes = 0;
+        uint64_t fileSize = 0;
+        {
+            MappedFile mapped(path);
+            string_view data = mapped.view();
+            fileSize = data.size();
+            JournalEntry entry;
+            while (true) {
+                string_view frame = data;
+                uint32_t length, sum;
+                if (!get(frame, length) || !get(frame, sum) || frame.size() < length) {
+                    break;
+                }
+                string_view body = frame.substr(0, length);
+                if (checksum(body.data(), body.size()) != sum || !decode(body, entry)) {
+                    break;
+                }
+                apply(entry);
+                count++;
+                data.remove_prefix(2 * sizeof(uint32_t) + length);
+                goodBytes = fileSize - data.size();
+            }
+        }
+        if (goodBytes < fileSize) {
+            cout << "Journal " << path << ": discarded " << (fileSize - goodBytes)
+                 << " bytes of incomplete entries\n";
+#ifndef _WIN32
+            if (truncate(path.c_str(), goodBytes) != 0) {
+                cout << "Could not truncate journal " << path << "\n";
+            }
+#endif
+        }
+        return count;
     }
 };
 
-Admin* Admin::instance = nullptr;
+// Role tag stored on every user so callers can check it without dynamic_cast
+enum class Role { Admin, Librarian, Member, Guest };
 
-class Librarian : public User {
-public:
-    Librarian(const string& uname, const string& pwd, const string& n, const string& e)
-        : User(uname, pwd, n, e) {}
+string roleToString(Role role) {
+    switch (role) {
+        case Role::Admin: return "admin";
+        case Role::Librarian: return "librarian";
+        case Role::Member: return "member";
+        case Role::Guest: return "guest";
+    }
+    return "";
+}
 
-    // Function overriding
+// Abstract base class for User
+class User {
+protected:
+    Role role;
+    string username;
+    string password;
+    string name;
+    string email;
+    static atomic<int> totalUsers; // Static data member
+
+public:
+    User(Role r, const string& uname, const string& pwd, const string& n, const string& e)
+        : role(r), username(uname), password(pwd), name(n), email(e) {
+        totalUsers++;
+    }
+
+    // Pure virtual function making this an abstract class
+    virtual void displayDashboard() = 0;
+
+    // Virtual destructor
+    virtual ~User() {
+        totalUsers--;
+    }
+
+    // Static member function
+    static int getTotalUsers() {
+        return totalUsers;
+    }
+
+    // Getters with const
+    Role getRole() const { return role; }
+    const string& getUsername() const { return username; }
+    const string& getName() const { return name; }
+    const string& getEmail() const { return email; }
+
+    // Friend function declaration
+    friend void displayUserInfo(const User& user);
+
+protected:
+    // Protected method for derived classes
+    void changePassword(const string& newPassword) {
+        password = newPassword;
+    }
+};
+
+atomic<int> User::totalUsers(0);
+
+// UserRegistry class: owns the users, indexed by username, with a roster of librarians.
+// Lookups by username only lock one stripe of the index; adding or removing a user
+// also takes the registry lock. A removed user is retired rather than freed, so a
+// User* handed to another thread stays valid until the registry is cleared.
+class UserRegistry {
+private:
+    vector<User*> users;
+    unordered_map<string, size_t> usernameIndex; // username -> position in users
+    vector<User*> librarians; // Precomputed roster for "any librarian" lookups
+    vector<User*> retired;    // Removed users, freed by clear()
+    LockStripes<unordered_map<string, User*>> byName; // username -> user, for find()
+    mutable shared_mutex registryLock; // Guards everything above except byName
+    Journal* journal;         // Receives every change once attached; null while loading
+
+public:
+    UserRegistry() : journal(nullptr) {}
+    UserRegistry(const UserRegistry&) = delete;
+    UserRegistry& operator=(const UserRegistry&) = delete;
+
+    // Destructor
+    ~UserRegistry() {
+        for (auto user : users) {
+            delete user;
+        }
+        for (auto user : retired) {
+            delete user;
+        }
+    }
+
+    // Takes ownership of the user; fails if the username is already taken
+    bool add(User* user) {
+        unique_lock<shared_mutex> guard(registryLock);
+        if (usernameIndex.count(user->getUsername()) != 0) {
+            return false;
+        }
+        usernameIndex[user->getUsername()] = users.size();
+        users.push_back(user);
+        {
+            auto& stripe = byName.of(user->getUsername());
+            unique_lock<shared_mutex> stripeGuard(stripe.lock);
+            stripe.map[user->getUsername()] = user;
+        }
+        if (user->getRole() == Role::Librarian) {
+            librarians.push_back(user);
+        }
+        if (journal != nullptr) {
+            journal->append({JournalOp::AddUser,
+                {roleToString(user->getRole()), user->getUsername(), user->getName(), user->getEmail()}, {}});
+        }
+        return true;
+    }
+
+    // Pre-sizes the containers for a bulk load
+    void reserve(size_t count) {
+        unique_lock<shared_mutex> guard(registryLock);
+        users.reserve(count);
+        usernameIndex.reserve(count);
+    }
+
+    // Constant-time lookup by username
+    User* find(const string& username) const {
+        auto& stripe = byName.of(username);
+        shared_lock<shared_mutex> guard(stripe.lock);
+        auto it = stripe.map.find(username);
+        return it != stripe.map.end() ? it->second : nullptr;
+    }
+
+    // Removes and retires the user; the last user takes its slot so no shifting is needed
+    bool remove(const string& username) {
+        unique_lock<shared_mutex> guard(registryLock);
+        auto it = usernameIndex.find(username);
+        if (it == usernameIndex.end()) {
+            return false;
+        }
+        size_t pos = it->second;
+        User* user = users[pos];
+        if (user->getRole() == Role::Librarian) {
+            librarians.erase(std::find(librarians.begin(), librarians.end(), user));
+        }
+        {
+            auto& stripe = byName.of(username);
+            unique_lock<shared_mutex> stripeGuard(stripe.lock);
+            stripe.map.erase(username);
+        }
+        retired.push_back(user);
+        usernameIndex.erase(it);
+        if (pos != users.size() - 1) {
+            users[pos] = users.back();
+            usernameIndex[users[pos]->getUsername()] = pos;
+        }
+        users.pop_back();
+        if (journal != nullptr) {
+            journal->append({JournalOp::RemoveUser, {username}, {}});
+        }
+        return true;
+    }
+
+    void setJournal(Journal* j) { journal = j; }
+
+    // Frees every user except the admin singleton, which survives a reload.
+    // No other thread may be holding a User* from this registry.
+    void clear() {
+        unique_lock<shared_mutex> guard(registryLock);
+        for (auto user : users) {
+            if (user->getRole() != Role::Admin) {
+                delete user;
+            }
+        }
+        for (auto user : retired) {
+            if (user->getRole() != Role::Admin) {
+                delete user;
+            }
+        }
+        users.clear();
+        usernameIndex.clear();
+        librarians.clear();
+        retired.clear();
+        for (auto& stripe : byName) {
+            unique_lock<shared_mutex> stripeGuard(stripe.lock);
+            stripe.map.clear();
+        }
+    }
+
+    // Any librarian can process member self-service requests
+    User* anyLibrarian() const {
+        shared_lock<shared_mutex> guard(registryLock);
+        return librarians.empty() ? nullptr : librarians.front();
+    }
+
+    size_t size() const {
+        shared_lock<shared_mutex> guard(registryLock);
+        return users.size();
+    }
+
+    // Blocks every add and remove until the returned lock is released; lookups continue.
+    // Iterating while other threads may change the registry requires holding it.
+    shared_lock<shared_mutex> freeze() const { return shared_lock<shared_mutex>(registryLock); }
+
+    // Iteration for listings
+    vector<User*>::const_iterator begin() const { return users.begin(); }
+    vector<User*>::const_iterator end() const { return users.end(); }
+};
+
+// Friend function definition
+void displayUserInfo(const User& user) {
+    cout << "User Info (via friend function):" << endl;
+    cout << "Username: " << user.username << endl;
+    cout << "Name: " << user.name << endl;
+    cout << "Email: " << user.email << endl;
+}
+
+// Book fields the catalog can be browsed by
+enum class Facet : uint8_t { Genre, Author };
+const size_t FACET_COUNT = 2;
+
+// The books filed under one genre or author and their live totals, kept by the
+// BookCatalog for browsing and reports
+struct FacetStock {
+    vector<uint32_t> docIds;  // Catalog docIds in ascending order
+    int titles = 0;
+    int copies = 0;           // docIds, titles and copies change under the catalog's lock
+    atomic<int> available{0}; // Changes with every issue and return
+};
+
+// Book class
+class Book {
+private:
+    string title;
+    string author;
+    string isbn;
+    string genre;
+    atomic<int> totalCopies;
+    // Twice the available count; the low bit is a lock, held for the few instructions it
+    // takes to change the count together with the genre totals, so the two always agree
+    atomic<int> availableCopies;
+    FacetStock* stocks[FACET_COUNT]; // Totals this book counts toward while catalogued; guarded by the lock bit
+    static atomic<int> totalBooks; // Static data member
+
+    // Takes the lock bit and returns the available count
+    int lockAvailable() {
+        int word = availableCopies.load();
+        while ((word & 1) != 0 || !availableCopies.compare_exchange_weak(word, word | 1)) {
+            if ((word & 1) != 0) {
+                this_thread::yield();
+                word = availableCopies.load();
+            }
+        }
+        return word >> 1;
+    }
+
+    // Stores the new count and releases the lock bit
+    void unlockAvailable(int available) {
+        availableCopies.store(available << 1);
+    }
+
+public:
+    // Constructor overloading
+    Book() : title(""), author(""), isbn(""), genre(""), totalCopies(0), availableCopies(0), stocks() {}
+    Book(const string& t, const string& a, const string& i, const string& g, int copies)
+        : title(t), author(a), isbn(i), genre(g), totalCopies(copies), availableCopies(copies << 1), stocks() {
+        totalBooks++;
+    }
+
+    // Destructor
+    ~Book() {
+        totalBooks--;
+    }
+
+    // Static member function
+    static int getTotalBooks() {
+        return totalBooks;
+    }
+
+    // Getters with const
+    const string& getTitle() const { return title; }
+    const string& getAuthor() const { return author; }
+    const string& getIsbn() const { return isbn; }
+    const string& getGenre() const { return genre; }
+    int getTotalCopies() const { return totalCopies; }
+    int getAvailableCopies() const { return availableCopies.load() >> 1; }
+
+    // Setters
+    void setTitle(const string& t) { title = t; }
+    void setAuthor(const string& a) { author = a; }
+    void setGenre(const string& g) { genre = g; }
+    // Copies on loan stay on loan, so the available count moves by the change in the
+    // total. Fails without changing anything if fewer copies than are on loan are asked for.
+    bool setTotalCopies(int copies) {
+        int available = lockAvailable();
+        if (copies < totalCopies - available) {
+            unlockAvailable(available);
+            return false;
+        }
+        int delta = copies - totalCopies;
+        for (FacetStock* stock : stocks) {
+            if (stock != nullptr) {
+                stock->copies += delta;
+                stock->available += delta;
+            }
+        }
+        totalCopies = copies;
+        unlockAvailable(available + delta);
+        return true;
+    }
+
+    // Moves the book's copies out of the totals it counts toward for the facet and into
+    // s (none if null). The catalog calls this under its lock when the book is added,
+    // re-filed under another genre or author, or removed.
+    void setStock(Facet facet, FacetStock* s) {
+        int available = lockAvailable();
+        FacetStock*& stock = stocks[static_cast<size_t>(facet)];
+        if (stock != nullptr) {
+            stock->titles--;
+            stock->copies -= totalCopies;
+            stock->available -= available;
+        }
+        stock = s;
+        if (stock != nullptr) {
+            stock->titles++;
+            stock->copies += totalCopies;
+            stock->available += available;
+        }
+        unlockAvailable(available);
+    }
+
+    // Member functions
+    // Takes a copy if one is available. Of two requests racing for the last copy,
+    // exactly one succeeds.
+    bool borrowCopy() {
+        if (getAvailableCopies() == 0) {
+            return false;
+        }
+        int available = lockAvailable();
+        bool taken = available > 0;
+        if (taken) {
+            available--;
+            for (FacetStock* stock : stocks) {
+                if (stock != nullptr) {
+                    stock->available--;
+                }
+            }
+        }
+        unlockAvailable(available);
+        return taken;
+    }
+
+    void returnCopy() {
+        int available = lockAvailable();
+        if (available < totalCopies.load()) {
+            available++;
+            for (FacetStock* stock : stocks) {
+                if (stock != nullptr) {
+                    stock->available++;
+                }
+            }
+        }
+        unlockAvailable(available);
+    }
+
+    // Operator overloading
+    bool operator==(const Book& other) const {
+        return isbn == other.isbn;
+    }
+
+    // Display book info
+    void display(Renderer& out) const {
+        out << "Title: " << title << "\nAuthor: " << author
+            << "\nISBN: " << isbn << "\nGenre: " << genre
+            << "\nCopies: " << getAvailableCopies() << '/' << totalCopies << '\n';
+    }
+
+    void display() const {
+        Renderer out(cout);
+        display(out);
+    }
+};
+
+atomic<int> Book::totalBooks(0);
+
+// Splits text into lowercase alphanumeric terms for the search index
+vector<string> tokenize(const string& text) {
+    vector<string> terms;
+    string term;
+    for (char c : text) {
+        if (isalnum(static_cast<unsigned char>(c))) {
+            term += static_cast<char>(tolower(static_cast<unsigned char>(c)));
+        } else if (!term.empty()) {
+            terms.push_back(term);
+            term.clear();
+        }
+    }
+    if (!term.empty()) {
+        terms.push_back(term);
+    }
+    return terms;
+}
+
+// Levenshtein distance between a and b if it is at most limit, otherwise limit + 1.
+// Only the diagonal band of width 2 * limit + 1 is computed: O(limit * length).
+size_t boundedEditDistance(string_view a, string_view b, size_t limit) {
+    if (a.size() > b.size()) {
+        swap(a, b);
+    }
+    if (b.size() - a.size() > limit) {
+        return limit + 1;
+    }
+    const size_t OVER = limit + 1;
+    vector<size_t> previous(b.size() + 1), current(b.size() + 1);
+    for (size_t j = 0; j <= b.size(); j++) {
+        previous[j] = min(j, OVER);
+    }
+    for (size_t i = 1; i <= a.size(); i++) {
+        size_t first = i > limit ? i - limit : 1;
+        size_t last = min(b.size(), i + limit);
+        current[first - 1] = first == 1 ? min(i, OVER) : OVER;
+        size_t rowBest = current[first - 1];
+        for (size_t j = first; j <= last; j++) {
+            size_t cost = previous[j - 1] + (a[i - 1] != b[j - 1] ? 1 : 0);
+            cost = min(cost, current[j - 1] + 1);
+            if (j < i + limit) { // previous[j] lies outside the band otherwise
+                cost = min(cost, previous[j] + 1);
+            }
+            current[j] = min(cost, OVER);
+            rowBest = min(rowBest, current[j]);
+        }
+        if (last < b.size()) {
+            current[last + 1] = OVER;
+        }
+        if (rowBest > limit) {
+            return OVER;
+        }
+        swap(previous, current);
+    }
+    return previous[b.size()];
+}
+
+// Parses a 13-digit ISBN into its 64-bit numeric key; false for anything else
+bool parseIsbn13(string_view isbn, uint64_t& key) {
+    if (isbn.size() != 13) {
+        return false;
+    }
+    key = 0;
+    for (char c : isbn) {
+        if (c < '0' || c > '9') {
+            return false;
+        }
+        key = key * 10 + static_cast<uint64_t>(c - '0');
+    }
+    return true;
+}
+
+// Stripe hash for ISBNs: an ISBN-13 spreads by its numeric key, anything else by its text
+struct IsbnHash {
+    size_t operator()(string_view isbn) const {
+        uint64_t key;
+        return parseIsbn13(isbn, key) ? static_cast<size_t>(key) : std::hash<string_view>()(isbn);
+    }
+};
+
+// IsbnMap class: hash map keyed by ISBN. ISBN-13s are stored under their 64-bit
+// key, so the common case hashes and compares one integer instead of a string;
+// any other identifier falls back to a map keyed by its text.
+template <typename V>
+class IsbnMap {
+private:
+    unordered_map<uint64_t, V> byKey;
+    unordered_map<string, V> byText;
+
+public:
+    V* find(string_view isbn) {
+        uint64_t key;
+        if (parseIsbn13(isbn, key)) {
+            auto it = byKey.find(key);
+            return it != byKey.end() ? &it->second : nullptr;
+        }
+        auto it = byText.find(string(isbn));
+        return it != byText.end() ? &it->second : nullptr;
+    }
+
+    const V* find(string_view isbn) const {
+        return const_cast<IsbnMap*>(this)->find(isbn);
+    }
+
+    // Fails if the ISBN is already present
+    bool insert(string_view isbn, const V& value) {
+        uint64_t key;
+        if (parseIsbn13(isbn, key)) {
+            return byKey.emplace(key, value).second;
+        }
+        return byText.emplace(string(isbn), value).second;
+    }
+
+    bool erase(string_view isbn) {
+        uint64_t key;
+        if (parseIsbn13(isbn, key)) {
+            return byKey.erase(key) != 0;
+        }
+        return byText.erase(string(isbn)) != 0;
+    }
+
+    void reserve(size_t count) { byKey.reserve(count); }
+
+    void clear() {
+        byKey.clear();
+        byText.clear();
+    }
+};
+
+// CompletionIndex class: ranked prefix completion over a set of strings, such as
+// titles. Each distinct string, ignoring case, carries a weight: here the copies
+// held of the books it names. complete() returns the heaviest strings starting with
+// a prefix, alphabetical among equals. Most strings sit in a sorted table with a
+// range-maximum tree over the weights, so the top k of any prefix cost O(k log n)
+// however many strings match. Changes go to a small ordered overlay that is folded
+// into the table by the first query after it grows past OVERLAY_LIMIT.
+class CompletionIndex {
+public:
+    struct Completion {
+        string text;
+        int weight;
+    };
+
+private:
+    static const size_t OVERLAY_LIMIT = 4096;
+    static constexpr uint32_t NONE = numeric_limits<uint32_t>::max();
+
+    struct Entry {
+        string text;    // As first added
+        int weight = 0;
+        int count = 0;  // Books carrying the string; 0 in the overlay hides a table entry
+    };
+
+    vector<string> keys;  // Sorted lowercase keys of the table
+    vector<Entry> entries; // Parallel to keys
+    vector<uint32_t> best; // Tree over the table: index of the heaviest entry below each node
+    size_t leaves = 0;
+    map<string, Entry> overlay; // Lowercase key -> entry, overriding the table
+    // Queries share it and take it alone only to fold the overlay. Changes come from
+    // the catalog under its exclusive lock, so they never overlap a query.
+    mutable shared_mutex foldLock;
+
+    static string keyOf(const string& text) {
+        string key(text);
+        for (char& c : key) {
+            c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+        }
+        return key;
+    }
+
+    // The heavier of two table entries, the first alphabetically on a tie
+    uint32_t heavier(uint32_t a, uint32_t b) const {
+        if (a == NONE || b == NONE) {
+            return a == NONE ? b : a;
+        }
+        if (entries[a].weight != entries[b].weight) {
+            return entries[a].weight > entries[b].weight ? a : b;
+        }
+        return min(a, b);
+    }
+
+    // The heaviest table entry in [first, last), or NONE
+    uint32_t heaviest(size_t first, size_t last) const {
+        uint32_t result = NONE;
+        for (first += leaves, last += leaves; first < last; first >>= 1, last >>= 1) {
+            if (first & 1) {
+                result = heavier(result, best[first++]);
+            }
+            if (last & 1) {
+                result = heavier(best[--last], result);
+            }
+        }
+        return result;
+    }
+
+    // The current entry for key, copied into the overlay so it can change
+    Entry& overlayEntry(const string& key) {
+        auto it = overlay.find(key);
+        if (it != overlay.end()) {
+            return it->second;
+        }
+        Entry& entry = overlay[key];
+        auto pos = lower_bound(keys.begin(), keys.end(), key);
+        if (pos != keys.end() && *pos == key) {
+            entry = entries[pos - keys.begin()];
+        }
+        return entry;
+    }
+
+    // Merges the overlay into the table and rebuilds the tree: O(n)
+    void fold() {
+        vector<string> mergedKeys;
+        vector<Entry> mergedEntries;
+        mergedKeys.reserve(keys.size() + overlay.size());
+        mergedEntries.reserve(keys.size() + overlay.size());
+        size_t i = 0;
+        auto changed = overlay.begin();
+        while (i < keys.size() || changed != overlay.end()) {
+            if (changed == overlay.end() || (i < keys.size() && keys[i] < changed->first)) {
+                mergedKeys.push_back(move(keys[i]));
+                mergedEntries.push_back(move(entries[i]));
+                i++;
+                continue;
+            }
+            if (i < keys.size() && keys[i] == changed->first) {
+                i++; // Replaced by the overlay's entry
+            }
+            if (changed->second.count > 0) {
+                mergedKeys.push_back(changed->first);
+                mergedEntries.push_back(move(changed->second));
+            }
+            ++changed;
+        }
+        keys.swap(mergedKeys);
+        entries.swap(mergedEntries);
+        overlay.clear();
+
+        leaves = 1;
+        while (leaves < keys.size()) {
+            leaves <<= 1;
+        }
+        best.assign(2 * leaves, NONE);
+        for (size_t i = 0; i < keys.size(); i++) {
+            best[leaves + i] = static_cast<uint32_t>(i);
+        }
+        for (size_t node = leaves - 1; node > 0; node--) {
+            best[node] = heavier(best[2 * node], best[2 * node + 1]);
+        }
+    }
+
+    vector<Completion> query(const string& prefix, size_t k) const {
+        auto startsWith = [&prefix](const string& key) { return key.compare(0, prefix.size(), prefix) == 0; };
+        struct Candidate {
+            const string* key;
+            const Entry* entry;
+        };
+        vector<Candidate> candidates;
+
+        // Table: take the heaviest entry of a range, then split the range around it
+        size_t first = lower_bound(keys.begin(), keys.end(), prefix) - keys.begin();
+        size_t last = partition_point(keys.begin() + first, keys.end(), startsWith) - keys.begin();
+        auto lighter = [this](const tuple<uint32_t, size_t, size_t>& a, const tuple<uint32_t, size_t, size_t>& b) {
+            return heavier(get<0>(a), get<0>(b)) == get<0>(b);
+        };
+        priority_queue<tuple<uint32_t, size_t, size_t>, vector<tuple<uint32_t, size_t, size_t>>, decltype(lighter)>
+            ranges(lighter);
+        if (first < last) {
+            ranges.emplace(heaviest(first, last), first, last);
+        }
+        size_t fromTable = 0;
+        while (!ranges.empty() && fromTable < k) {
+            uint32_t top;
+            size_t low, high;
+            tie(top, low, high) = ranges.top();
+            ranges.pop();
+            if (overlay.count(keys[top]) == 0) { // Otherwise the overlay has its current entry
+                candidates.push_back({&keys[top], &entries[top]});
+                fromTable++;
+            }
+            if (low < top) {
+                ranges.emplace(heaviest(low, top), low, top);
+            }
+            if (top + 1 < high) {
+                ranges.emplace(heaviest(top + 1, high), top + 1, high);
+            }
+        }
+
+        for (auto it = overlay.lower_bound(prefix); it != overlay.end() && startsWith(it->first); ++it) {
+            if (it->second.count > 0) {
+                candidates.push_back({&it->first, &it->second});
+            }
+        }
+
+        size_t shown = min(k, candidates.size());
+        partial_sort(candidates.begin(), candidates.begin() + shown, candidates.end(),
+            [](const Candidate& a, const Candidate& b) {
+                return a.entry->weight != b.entry->weight ? a.entry->weight > b.entry->weight : *a.key < *b.key;
+            });
+        vector<Completion> results;
+        for (size_t i = 0; i < shown; i++) {
+            results.push_back({candidates[i].entry->text, candidates[i].entry->weight});
+        }
+        return results;
+    }
+
+public:
+    // One more book carries the string, adding weight
+    void add(const string& text, int weight) {
+        Entry& entry = overlayEntry(keyOf(text));
+        if (entry.count++ == 0) {
+            entry.text = text;
+        }
+        entry.weight += weight;
+    }
+
+    // Undoes add(text, weight)
+    void remove(const string& text, int weight) {
+        Entry& entry = overlayEntry(keyOf(text));
+        entry.count--;
+        entry.weight -= weight;
+    }
+
+    // Up to k strings starting with prefix (ignoring case), heaviest first
+    vector<Completion> complete(const string& prefix, size_t k) {
+        string key = keyOf(prefix);
+        {
+            shared_lock<shared_mutex> guard(foldLock);
+            if (overlay.size() <= OVERLAY_LIMIT) {
+                return query(key, k);
+            }
+        }
+        unique_lock<shared_mutex> guard(foldLock);
+        if (overlay.size() > OVERLAY_LIMIT) {
+            fold();
+        }
+        return query(key, k);
+    }
+
+    // Folds pending changes in now, e.g. after a bulk load
+    void compact() {
+        unique_lock<shared_mutex> guard(foldLock);
+        fold();
+    }
+
+    void clear() {
+        keys.clear();
+        entries.clear();
+        best.clear();
+        leaves = 0;
+        overlay.clear();
+    }
+};
+
+// BookCatalog class: owns the books and keeps an ISBN index and a search index in sync with them.
+// Lookups by ISBN only lock one stripe of the index, so circulation never waits on
+// searches or catalog edits; everything else is guarded by the catalog lock. A removed
+// book is retired rather than freed, so a Book* handed to another thread stays valid
+// until the catalog is cleared.
+class BookCatalog {
+private:
+    struct Entry {
+        size_t pos;     // Position in books
+        uint32_t docId; // Stable id used by the posting lists
+    };
+
+    vector<Book*> books;
+    IsbnMap<Entry> isbnIndex; // ISBN -> entry
+    unordered_map<uint32_t, Book*> docs;
+    typedef unordered_map<string, vector<uint32_t>> Postings;
+    Postings postings; // term -> docIds in ascending order
+    // Trigram of "$term$" -> terms containing it, for fuzzy matching; the pointers stay
+    // valid because the map's nodes never move
+    unordered_map<uint32_t, vector<const Postings::value_type*>> termGrams;
+    uint32_t nextDocId = 0;
+    vector<Book*> retired; // Removed books, freed by clear()
+    map<string, unique_ptr<FacetStock>> facets[FACET_COUNT]; // Genre or author -> books and live totals;
+                                                              // entries are never dropped before clear()
+    // Titles and authors weighted by copies held, for complete()
+    mutable CompletionIndex titleCompletions;
+    mutable CompletionIndex authorCompletions;
+    LockStripes<IsbnMap<Book*>, IsbnHash> byIsbn; // ISBN -> book, for find()
+    mutable shared_mutex catalogLock; // Guards everything above except byIsbn
+    Journal* journal = nullptr; // Receives every change once attached; null while loading
+
+    // Distinct terms of the searchable fields (title, author, genre)
+    static vector<string> termsOf(const Book* book) {
+        vector<string> terms = tokenize(book->getTitle() + " " + book->getAuthor() + " " + book->getGenre());
+        sort(terms.begin(), terms.end());
+        terms.erase(unique(terms.begin(), terms.end()), terms.end());
+        return terms;
+    }
+
+    static const string& facetOf(const Book* book, Facet facet) {
+        return facet == Facet::Genre ? book->getGenre() : book->getAuthor();
+    }
+
+    // Files the book under its genre and author
+    void file(Book* book, uint32_t docId) {
+        for (size_t f = 0; f < FACET_COUNT; f++) {
+            unique_ptr<FacetStock>& stock = facets[f][facetOf(book, Facet(f))];
+            if (!stock) {
+                stock.reset(new FacetStock());
+            }
+            vector<uint32_t>& list = stock->docIds;
+            list.insert(upper_bound(list.begin(), list.end(), docId), docId);
+            book->setStock(Facet(f), stock.get());
+        }
+        titleCompletions.add(book->getTitle(), book->getTotalCopies());
+        authorCompletions.add(book->getAuthor(), book->getTotalCopies());
+    }
+
+    // copies is the total the book was filed with
+    void unfile(Book* book, uint32_t docId, int copies) {
+        for (size_t f = 0; f < FACET_COUNT; f++) {
+            auto it = facets[f].find(facetOf(book, Facet(f)));
+            if (it != facets[f].end()) {
+                vector<uint32_t>& list = it->second->docIds;
+                auto pos = lower_bound(list.begin(), list.end(), docId);
+                if (pos != list.end() && *pos == docId) {
+                    list.erase(pos);
+                }
+            }
+            book->setStock(Facet(f), nullptr);
+        }
+        titleCompletions.remove(book->getTitle(), copies);
+        authorCompletions.remove(book->getAuthor(), copies);
+    }
+
+    // Distinct trigrams of the term padded with '$' at both ends
+    static vector<uint32_t> gramsOf(const string& term) {
+        string padded = "$" + term + "$";
+        vector<uint32_t> grams;
+        for (size_t i = 0; i + 3 <= padded.size(); i++) {
+            grams.push_back(static_cast<uint32_t>(static_cast<unsigned char>(padded[i])) << 16 |
+                            static_cast<uint32_t>(static_cast<unsigned char>(padded[i + 1])) << 8 |
+                            static_cast<unsigned char>(padded[i + 2]));
+        }
+        sort(grams.begin(), grams.end());
+        grams.erase(unique(grams.begin(), grams.end()), grams.end());
+        return grams;
+    }
+
+    // Typos tolerated in a query term of the given length
+    static size_t typoLimit(size_t length) {
+        return length <= 3 ? 0 : length <= 7 ? 1 : 2;
+    }
+
+    void index(const Book* book, uint32_t docId) {
+        for (const auto& term : termsOf(book)) {
+            // docIds only grow, except on edit, so this is almost always an append
+            auto inserted = postings.emplace(term, vector<uint32_t>());
+            vector<uint32_t>& list = inserted.first->second;
+            list.insert(upper_bound(list.begin(), list.end(), docId), docId);
+            if (inserted.second) {
+                for (uint32_t gram : gramsOf(term)) {
+                    termGrams[gram].push_back(&*inserted.first);
+                }
+            }
+        }
+    }
+
+    void unindex(const Book* book, uint32_t docId) {
+        for (const auto& term : termsOf(book)) {
+            auto it = postings.find(term);
+            if (it == postings.end()) {
+                continue;
+            }
+            vector<uint32_t>& list = it->second;
+            auto pos = lower_bound(list.begin(), list.end(), docId);
+            if (pos != list.end() && *pos == docId) {
+                list.erase(pos);
+            }
+            if (list.empty()) {
+                for (uint32_t gram : gramsOf(term)) {
+                    vector<const Postings::value_type*>& terms = termGrams[gram];
+                    terms.erase(std::find(terms.begin(), terms.end(), &*it));
+                    if (terms.empty()) {
+                        termGrams.erase(gram);
+                    }
+                }
+                postings.erase(it);
+            }
+        }
+    }
+
+    // Catalogued terms within typoLimit edits of term, with their distances. Candidates
+    // share enough trigrams with the term to be that close (each edit changes at most
+    // three), and only they are checked with boundedEditDistance.
+    vector<pair<const Postings::value_type*, size_t>> variantsOf(const string& term) const {
+        size_t limit = typoLimit(term.size());
+        vector<pair<const Postings::value_type*, size_t>> variants;
+        if (limit == 0) {
+            auto it = postings.find(term);
+            if (it != postings.end()) {
+                variants.push_back({&*it, 0});
+            }
+            return variants;
+        }
+        vector<uint32_t> grams = gramsOf(term);
+        size_t needed = grams.size() > 3 * limit ? grams.size() - 3 * limit : 1;
+        unordered_map<const Postings::value_type*, size_t> shared;
+        for (uint32_t gram : grams) {
+            auto it = termGrams.find(gram);
+            if (it != termGrams.end()) {
+                for (const auto* candidate : it->second) {
+                    shared[candidate]++;
+                }
+            }
+        }
+        for (const auto& entry : shared) {
+            if (entry.second >= needed) {
+                size_t distance = boundedEditDistance(term, entry.first->first, limit);
+                if (distance <= limit) {
+                    variants.push_back({entry.first, distance});
+                }
+            }
+        }
+        return variants;
+    }
+
+public:
+    BookCatalog() {}
+    BookCatalog(const BookCatalog&) = delete;
+    BookCatalog& operator=(const BookCatalog&) = delete;
+
+    // Destructor
+    ~BookCatalog() {
+        clear();
+    }
+
+    // Takes ownership of the book; fails if the ISBN is already in the catalog
+    bool add(Book* book) {
+        unique_lock<shared_mutex> guard(catalogLock);
+        if (!isbnIndex.insert(book->getIsbn(), Entry{books.size(), nextDocId})) {
+            return false;
+        }
+        uint32_t docId = nextDocId++;
+        books.push_back(book);
+        {
+            auto& stripe = byIsbn.of(book->getIsbn());
+            unique_lock<shared_mutex> stripeGuard(stripe.lock);
+            stripe.map.insert(book->getIsbn(), book);
+        }
+        docs[docId] = book;
+        index(book, docId);
+        file(book, docId);
+        if (journal != nullptr) {
+            journal->append({JournalOp::AddBook,
+                {book->getTitle(), book->getAuthor(), book->getIsbn(), book->getGenre()}, {book->getTotalCopies()}});
+        }
+        return true;
+    }
+
+    // Pre-sizes the containers for a bulk load
+    void reserve(size_t count) {
+        unique_lock<shared_mutex> guard(catalogLock);
+        books.reserve(count);
+        isbnIndex.reserve(count);
+        docs.reserve(count);
+    }
+
+    // Constant-time lookup by ISBN
+    Book* find(const string& isbn) const {
+        auto& stripe = byIsbn.of(isbn);
+        shared_lock<shared_mutex> guard(stripe.lock);
+        Book* const* book = stripe.map.find(isbn);
+        return book != nullptr ? *book : nullptr;
+    }
+
+    // Updates the searchable fields of a catalogued book and re-indexes it.
+    // Fails, leaving the book as it was, if it was removed since it was looked up or
+    // if the new number of copies is below the number on loan.
+    bool edit(Book* book, const string& title, const string& author, const string& genre, int copies) {
+        unique_lock<shared_mutex> guard(catalogLock);
+        const Entry* entry = isbnIndex.find(book->getIsbn());
+        if (entry == nullptr || books[entry->pos] != book) {
+            return false;
+        }
+        // Checked and set before anything is unindexed; re-filing below moves the new
+        // copy counts from the book's old facet totals to its new ones
+        int filedCopies = book->getTotalCopies();
+        if (!book->setTotalCopies(copies)) {
+            return false;
+        }
+        uint32_t docId = entry->docId;
+        unindex(book, docId);
+        unfile(book, docId, filedCopies);
+        book->setTitle(title);
+        book->setAuthor(author);
+        book->setGenre(genre);
+        index(book, docId);
+        file(book, docId);
+        if (journal != nullptr) {
+            journal->append({JournalOp::EditBook, {book->getIsbn(), title, author, genre}, {copies}});
+        }
+        return true;
+    }
+
+    // Books containing every query term (case-insensitive) in their title, author or genre,
+    // in the order they were added. Cost follows the shortest posting list, not the catalog.
+    // An empty query matches every book.
+    vector<Book*> search(const string& query) const {
+        OperationTimer timer(Operation::Search);
+        vector<string> terms = tokenize(query);
+        shared_lock<shared_mutex> guard(catalogLock);
+        if (terms.empty()) {
+            return books;
+        }
+
+        vector<const vector<uint32_t>*> lists;
+        for (const auto& term : terms) {
+            auto it = postings.find(term);
+            if (it == postings.end()) {
+                return {};
+            }
+            lists.push_back(&it->second);
+        }
+        sort(lists.begin(), lists.end(),
+            [](const vector<uint32_t>* a, const vector<uint32_t>* b) { return a->size() < b->size(); });
+
+        vector<Book*> results;
+        for (uint32_t docId : *lists[0]) {
+            bool inAll = true;
+            for (size_t i = 1; i < lists.size() && inAll; i++) {
+                inAll = binary_search(lists[i]->begin(), lists[i]->end(), docId);
+            }
+            if (inAll) {
+                results.push_back(docs.at(docId));
+            }
+        }
+        return results;
+    }
+
+    // Up to k books matching every query term within a few typos (none for terms of up
+    // to 3 characters, one up to 7, two beyond) in their title, author or genre, fewest
+    // typos first, then in the order they were added. Terms are matched through a
+    // trigram index over the catalogued terms; documents are enumerated from the term
+    // with the fewest postings and kept in a bounded heap, so only the k results that
+    // rank are materialized.
+    vector<Book*> fuzzySearch(const string& query, size_t k) const {
+        OperationTimer timer(Operation::FuzzySearch);
+        vector<string> terms = tokenize(query);
+        sort(terms.begin(), terms.end());
+        terms.erase(unique(terms.begin(), terms.end()), terms.end());
+        shared_lock<shared_mutex> guard(catalogLock);
+        if (terms.empty() || k == 0) {
+            return {};
+        }
+
+        // Each term's variants and the total postings they cover
+        vector<vector<pair<const Postings::value_type*, size_t>>> variants;
+        size_t driver = 0, driverSize = numeric_limits<size_t>::max();
+        for (const auto& term : terms) {
+            variants.push_back(variantsOf(term));
+            if (variants.back().empty()) {
+                return {};
+            }
+            size_t size = 0;
+            for (const auto& variant : variants.back()) {
+                size += variant.first->second.size();
+            }
+            if (size < driverSize) {
+                driver = variants.size() - 1;
+                driverSize = size;
+            }
+        }
+
+        // Documents of the rarest term, each with its closest variant
+        vector<pair<uint32_t, size_t>> docsOfDriver;
+        docsOfDriver.reserve(driverSize);
+        for (const auto& variant : variants[driver]) {
+            for (uint32_t docId : variant.first->second) {
+                docsOfDriver.push_back({docId, variant.second});
+            }
+        }
+        sort(docsOfDriver.begin(), docsOfDriver.end());
+
+        // Max-heap of the best k as (typos, docId): the worst kept result is on top
+        priority_queue<pair<size_t, uint32_t>> best;
+        for (size_t i = 0; i < docsOfDriver.size(); i++) {
+            uint32_t docId = docsOfDriver[i].first;
+            if (i > 0 && docId == docsOfDriver[i - 1].first) {
+                continue; // Sorted, so the first entry has the smallest distance
+            }
+            size_t typos = docsOfDriver[i].second;
+            for (size_t t = 0; t < variants.size() && typos != numeric_limits<size_t>::max(); t++) {
+                if (t == driver) {
+                    continue;
+                }
+                size_t closest = numeric_limits<size_t>::max();
+                for (const auto& variant : variants[t]) {
+                    if (variant.second < closest &&
+                        binary_search(variant.first->second.begin(), variant.first->second.end(), docId)) {
+                        closest = variant.second;
+                    }
+                }
+                typos = closest == numeric_limits<size_t>::max() ? closest : typos + closest;
+            }
+            if (typos == numeric_limits<size_t>::max()) {
+                continue;
+            }
+            if (best.size() < k) {
+                best.push({typos, docId});
+            } else if (make_pair(typos, docId) < best.top()) {
+                best.pop();
+                best.push({typos, docId});
+            }
+        }
+
+        vector<Book*> results(best.size());
+        for (size_t i = results.size(); i-- > 0; best.pop()) {
+            results[i] = docs.at(best.top().second);
+        }
+        return results;
+    }
+
+    // Titles and authors starting with prefix (ignoring case) for a search box, k of
+    // each, those with the most copies held first: O(k log n) per keystroke
+    struct Suggestions {
+        vector<CompletionIndex::Completion> titles, authors;
+    };
+
+    Suggestions complete(const string& prefix, size_t k) const {
+        OperationTimer timer(Operation::Complete);
+        shared_lock<shared_mutex> guard(catalogLock);
+        return {titleCompletions.complete(prefix, k), authorCompletions.complete(prefix, k)};
+    }
+
+    // Builds the completion tables now rather than on the first keystroke; for after a bulk load
+    void compactCompletions() {
+        shared_lock<shared_mutex> guard(catalogLock);
+        titleCompletions.compact();
+        authorCompletions.compact();
+    }
+
+    // Removes and retires the book; the last book takes its slot so no shifting is needed
+    bool remove(const string& isbn) {
+        unique_lock<shared_mutex> guard(catalogLock);
+        const Entry* entry = isbnIndex.find(isbn);
+        if (entry == nullptr) {
+            return false;
+        }
+        size_t pos = entry->pos;
+        uint32_t docId = entry->docId;
+        unindex(books[pos], docId);
+        unfile(books[pos], docId, books[pos]->getTotalCopies());
+        docs.erase(docId);
+        isbnIndex.erase(isbn);
+        {
+            auto& stripe = byIsbn.of(isbn);
+            unique_lock<shared_mutex> stripeGuard(stripe.lock);
+            stripe.map.erase(isbn);
+        }
+        retired.push_back(books[pos]);
+        if (pos != books.size() - 1) {
+            books[pos] = books.back();
+            isbnIndex.find(books[pos]->getIsbn())->pos = pos;
+        }
+        books.pop_back();
+        if (journal != nullptr) {
+            journal->append({JournalOp::DeleteBook, {isbn}, {}});
+        }
+        return true;
+    }
+
+    void setJournal(Journal* j) { journal = j; }
+
+    // No other thread may be holding a Book* from this catalog
+    void clear() {
+        unique_lock<shared_mutex> guard(catalogLock);
+        for (auto book : books) {
+            delete book;
+        }
+        for (auto book : retired) {
+            delete book;
+        }
+        books.clear();
+        retired.clear();
+        isbnIndex.clear();
+        docs.clear();
+        postings.clear();
+        termGrams.clear();
+        for (auto& values : facets) {
+            values.clear();
+        }
+        titleCompletions.clear();
+        authorCompletions.clear();
+        nextDocId = 0;
+        for (auto& stripe : byIsbn) {
+            unique_lock<shared_mutex> stripeGuard(stripe.lock);
+            stripe.map.clear();
+        }
+    }
+
+    size_t size() const {
+        shared_lock<shared_mutex> guard(catalogLock);
+        return books.size();
+    }
+
+    // Titles, copies and available copies per genre or author, in name order: O(values)
+    struct FacetTotals {
+        string value;
+        int titles, copies, available;
+    };
+
+    vector<FacetTotals> facetTotals(Facet facet) const {
+        shared_lock<shared_mutex> guard(catalogLock);
+        vector<FacetTotals> totals;
+        for (const auto& entry : facets[static_cast<size_t>(facet)]) {
+            if (entry.second->titles > 0) {
+                totals.push_back({entry.first, entry.second->titles, entry.second->copies,
+                                  entry.second->available.load()});
+            }
+        }
+        return totals;
+    }
+
+    // Up to limit of the books filed under one genre or author, in the order they were
+    // added, starting at offset, with that value's totals: one lookup, then O(limit).
+    // Fails if no catalogued book has the value.
+    struct FacetPage {
+        int titles, copies, available;
+        vector<Book*> books;
+    };
+
+    bool browse(Facet facet, const string& value, size_t offset, size_t limit, FacetPage& page) const {
+        shared_lock<shared_mutex> guard(catalogLock);
+        const auto& values = facets[static_cast<size_t>(facet)];
+        auto it = values.find(value);
+        if (it == values.end() || it->second->titles == 0) {
+            return false;
+        }
+        const FacetStock& stock = *it->second;
+        page.titles = stock.titles;
+        page.copies = stock.copies;
+        page.available = stock.available.load();
+        page.books.clear();
+        for (size_t i = offset; i < stock.docIds.size() && i - offset < limit; i++) {
+            page.books.push_back(docs.at(stock.docIds[i]));
+        }
+        return true;
+    }
+
+    // Blocks every add, edit and remove until the returned lock is released; lookups
+    // and searches continue. Iterating while other threads may change the catalog
+    // requires holding it.
+    shared_lock<shared_mutex> freeze() const { return shared_lock<shared_mutex>(catalogLock); }
+
+    // Iteration for listings
+    vector<Book*>::const_iterator begin() const { return books.begin(); }
+    vector<Book*>::const_iterator end() const { return books.end(); }
+};
+
+// BorrowRecord class
+class Fine {
+private:
+    double amount;
+    time_t daysOverdue;
+
+public:
+    Fine(time_t secondsOverdue) {
+        daysOverdue = secondsOverdue / (24 * 60 * 60);
+        amount = daysOverdue * DAILY_FINE;
+    }
+
+    // Getters with const
+    double getAmount() const { return amount; }
+    time_t getDaysOverdue() const { return daysOverdue; }
+
+    // Pay fine
+    void payFine(double payment) {
+        amount -= payment;
+        if (amount < 0) amount = 0;
+    }
+};
+// BorrowRecord class: a read-only view of one loan in the RecordStore.
+// The user and ISBN point at the store's interned strings, so a view is cheap to copy.
+class BorrowRecord {
+private:
+    const string* userId;
+    const string* bookIsbn;
+    time_t borrowDate;
+    time_t dueDate;
+    time_t returnDate;
+    bool returned;
+
+public:
+    BorrowRecord(const string* uid, const string* isbn, time_t bDate, time_t dDate, time_t rDate, bool isReturned)
+        : userId(uid), bookIsbn(isbn), borrowDate(bDate), dueDate(dDate),
+          returnDate(rDate), returned(isReturned) {}
+
+    // Getters with const
+    const string& getUserId() const { return *userId; }
+    const string& getBookIsbn() const { return *bookIsbn; }
+    time_t getBorrowDate() const { return borrowDate; }
+    time_t getDueDate() const { return dueDate; }
+    time_t getReturnDate() const { return returnDate; }
+    bool isReturned() const { return returned; }
+
+    // A fine is owed when the book came back after its due date
+    bool hasFine() const { return returned && returnDate > dueDate; }
+    Fine getFine() const { return Fine(returnDate - dueDate); }
+
+    // Display record; open loans are shown as of now
+    void display(Renderer& out, time_t now) const {
+        out << "User ID: " << *userId << "\nBook ISBN: " << *bookIsbn << "\nBorrowed: ";
+        out.date(borrowDate) << "\nDue: ";
+        out.date(dueDate);
+        if (returned) {
+            out << "\nReturned: ";
+            out.date(returnDate);
+            if (hasFine()) {
+                out << "\nFine: ";
+                out.money(getFine().getAmount());
+            }
+        } else {
+            out << "\nStatus: Not returned";
+            if (now > dueDate) {
+                out << "\nOverdue by " << (now - dueDate) / (24 * 60 * 60) << " days";
+            }
+        }
+        out << '\n';
+    }
+
+    void display() const {
+        Renderer out(cout);
+        display(out, getCurrentTime());
+    }
+};
+
+// ChunkedColumn class: one column of the record store, kept in fixed-size chunks.
+// Growing never moves existing values, and each chunk is a contiguous array
+// that full-history scans can stream through. The chunk directory has a fixed
+// size, so reading a published value never needs a lock, and several threads
+// can fill distinct slots at once; size() covers the values published so far.
+template <typename T>
+class ChunkedColumn {
+public:
+    static const size_t CHUNK_BITS = 16;
+    static constexpr size_t CHUNK_SIZE = size_t(1) << CHUNK_BITS;
+    static const size_t MAX_CHUNKS = size_t(1) << 14; // Room for 2^30 values
+
+private:
+    unique_ptr<atomic<T*>[]> chunks;
+    atomic<size_t> count;
+
+    // Chunk c, allocating it if this is the first value to land there
+    T* chunkAt(size_t c) {
+        T* chunk = chunks[c].load(memory_order_acquire);
+        if (chunk == nullptr) {
+            T* fresh = new T[CHUNK_SIZE];
+            if (chunks[c].compare_exchange_strong(chunk, fresh, memory_order_acq_rel)) {
+                chunk = fresh;
+            } else {
+                delete[] fresh; // Another thread allocated it first
+            }
+        }
+        return chunk;
+    }
+
+public:
+    ChunkedColumn() : chunks(new atomic<T*>[MAX_CHUNKS]()), count(0) {}
+    ChunkedColumn(const ChunkedColumn&) = delete;
+    ChunkedColumn& operator=(const ChunkedColumn&) = delete;
+
+    // Destructor
+    ~ChunkedColumn() {
+        clear();
+    }
+
+    // Appends and publishes one value; single writer only
+    void push_back(const T& value) {
+        size_t n = count.load(memory_order_relaxed);
+        chunkAt(n >> CHUNK_BITS)[n & (CHUNK_SIZE - 1)] = value;
+        count.store(n + 1, memory_order_release);
+    }
+
+    // Bulk append, one memcpy per chunk; single writer only
+    void append(const T* values, size_t n) {
+        size_t end = count.load(memory_order_relaxed);
+        while (n > 0) {
+            size_t offset = end & (CHUNK_SIZE - 1);
+            size_t take = min(n, CHUNK_SIZE - offset);
+            memcpy(static_cast<void*>(chunkAt(end >> CHUNK_BITS) + offset), values, take * sizeof(T));
+            end += take;
+            values += take;
+            n -= take;
+        }
+        count.store(end, memory_order_release);
+    }
+
+    // Slot i for writing, whether or not it is published yet. Threads may fill
+    // distinct slots concurrently; publish() then makes them visible.
+    T& slot(size_t i) { return chunkAt(i >> CHUNK_BITS)[i & (CHUNK_SIZE - 1)]; }
+
+    // Allocates the chunk slot i lands in, so that filling it later cannot throw
+    void prepare(size_t i) { chunkAt(i >> CHUNK_BITS); }
+
+    // Makes the first n values visible through size()
+    void publish(size_t n) { count.store(n, memory_order_release); }
+
+    T& operator[](size_t i) { return chunks[i >> CHUNK_BITS].load(memory_order_acquire)[i & (CHUNK_SIZE - 1)]; }
+    const T& operator[](size_t i) const { return chunks[i >> CHUNK_BITS].load(memory_order_acquire)[i & (CHUNK_SIZE - 1)]; }
+
+    size_t size() const { return count.load(memory_order_acquire); }
+    size_t chunkCount() const { return (size() + CHUNK_SIZE - 1) >> CHUNK_BITS; }
+    const T* chunk(size_t c) const { return chunks[c].load(memory_order_acquire); }
+    // Number of values in chunk c
+    size_t chunkLength(size_t c) const { return min(CHUNK_SIZE, size() - (c << CHUNK_BITS)); }
+
+    // Allocates the chunks for n values up front
+    void reserve(size_t n) {
+        for (size_t c = 0; c < ((n + CHUNK_SIZE - 1) >> CHUNK_BITS); c++) {
+            chunkAt(c);
+        }
+    }
+
+    // Counts a whole chunk of values as appended without storing them, for values kept
+    // elsewhere; size() must be at a chunk boundary. Single writer only.
+    void skipChunk() {
+        size_t n = count.load(memory_order_relaxed);
+        delete[] chunks[n >> CHUNK_BITS].exchange(nullptr); // Allocated by reserve()
+        count.store(n + CHUNK_SIZE, memory_order_release);
+    }
+
+    // Frees chunk c once its values have been moved elsewhere; nothing may read them
+    // any more, and nothing may write to the chunk again
+    void release(size_t c) {
+        delete[] chunks[c].exchange(nullptr);
+    }
+
+    // Not safe against concurrent readers or writers
+    void clear() {
+        for (size_t c = 0; c < MAX_CHUNKS; c++) {
+            delete[] chunks[c].exchange(nullptr);
+        }
+        count = 0;
+    }
+};
+
+// Whole days past due of count loans, as Fine counts them: up to the return date for
+// returned loans and up to now for open ones. With GCC and Clang the arithmetic is
+// written on vector types, so the compiler emits SIMD instructions for the target
+// (four loans per step); other compilers get the plain loop.
+void fineDaysOf(const time_t* dueDates, const time_t* returnDates, const uint8_t* returned,
+                time_t now, uint32_t* days, size_t count) {
+    const time_t DAY = 24 * 60 * 60;
+    size_t i = 0;
+#ifdef __GNUC__
+    typedef int64_t Int64Lanes __attribute__((vector_size(32)));
+    typedef double DoubleLanes __attribute__((vector_size(32)));
+    typedef int32_t Int32Lanes __attribute__((vector_size(16)));
+    // x + MAGIC_BITS, read as a double, is exactly MAGIC + x for |x| < 2^51: an int64 to
+    // double conversion that needs no instruction most targets lack
+    const int64_t MAGIC_BITS = 0x4338000000000000;
+    const double MAGIC = 6755399441055744.0; // 2^52 + 2^51
+    for (; i + 4 <= count; i += 4) {
+        Int64Lanes due, returnDate;
+        memcpy(&due, dueDates + i, sizeof(due));
+        memcpy(&returnDate, returnDates + i, sizeof(returnDate));
+        Int64Lanes isReturned = {-int64_t(returned[i] != 0), -int64_t(returned[i + 1] != 0),
+                                 -int64_t(returned[i + 2] != 0), -int64_t(returned[i + 3] != 0)};
+        Int64Lanes late = ((returnDate & isReturned) | (now & ~isReturned)) - due + MAGIC_BITS;
+        DoubleLanes seconds;
+        memcpy(&seconds, &late, sizeof(seconds));
+        // Correctly rounded division of exact values, so truncation gives whole days
+        DoubleLanes whole = (seconds - MAGIC) / double(DAY);
+        whole = whole > 0 ? whole : 0;
+        Int32Lanes result = __builtin_convertvector(whole, Int32Lanes);
+        memcpy(days + i, &result, sizeof(result));
+    }
+#endif
+    for (; i < count; i++) {
+        time_t end = returned[i] ? returnDates[i] : now;
+        days[i] = end > dueDates[i] ? static_cast<uint32_t>((end - dueDates[i]) / DAY) : 0;
+    }
+}
+
+// StringPool class: gives each distinct string a dense id. Ids are never reused,
+// and the strings never move, so views and pointers to them stay valid.
+// Looking up a known string locks one stripe for reading; get() takes no lock.
+class StringPool {
+private:
+    ChunkedColumn<string> strings;
+    LockStripes<unordered_map<string_view, uint32_t>> ids; // Views into strings
+    mutex appendLock; // Hands out new ids one at a time so they stay dense
+
+public:
+    static const uint32_t NO_ID = static_cast<uint32_t>(-1);
+
+    StringPool() {}
+    StringPool(const StringPool&) = delete;
+    StringPool& operator=(const StringPool&) = delete;
+
+    uint32_t intern(string_view s) {
+        uint32_t id = find(s);
+        if (id != NO_ID) {
+            return id;
+        }
+        auto& stripe = ids.of(s);
+        unique_lock<shared_mutex> guard(stripe.lock);
+        auto it = stripe.map.find(s);
+        if (it != stripe.map.end()) {
+            return it->second; // Interned by another thread in the meantime
+        }
+        lock_guard<mutex> append(appendLock);
+        id = static_cast<uint32_t>(strings.size());
+        strings.push_back(string(s));
+        stripe.map.emplace(string_view(strings[id]), id);
+        return id;
+    }
+
+    // Id of s, or NO_ID if it was never interned
+    uint32_t find(string_view s) const {
+        auto& stripe = ids.of(s);
+        shared_lock<shared_mutex> guard(stripe.lock);
+        auto it = stripe.map.find(s);
+        return it != stripe.map.end() ? it->second : NO_ID;
+    }
+
+    const string& get(uint32_t id) const { return strings[id]; }
+    size_t size() const { return strings.size(); }
+
+    void clear() {
+        for (auto& stripe : ids) {
+            unique_lock<shared_mutex> guard(stripe.lock);
+            stripe.map.clear();
+        }
+        strings.clear();
+    }
+};
+
+// Identifiers class: library-wide interning of usernames and ISBNs into dense ids,
+// so loan data carries 32-bit ids instead of strings. ISBN-13s are looked up by
+// their 64-bit key. Ids only grow, and each name is stored exactly once.
+class Identifiers {
+private:
+    StringPool userNames;
+    ChunkedColumn<string> isbnTexts; // Book id -> ISBN as entered
+    LockStripes<IsbnMap<uint32_t>, IsbnHash> isbnIds;
+    mutex isbnAppendLock; // Hands out new book ids one at a time so they stay dense
+
+public:
+    static const uint32_t NO_ID = StringPool::NO_ID;
+
+    Identifiers() {}
+    Identifiers(const Identifiers&) = delete;
+    Identifiers& operator=(const Identifiers&) = delete;
+
+    uint32_t internUser(string_view name) { return userNames.intern(name); }
+    uint32_t findUser(string_view name) const { return userNames.find(name); }
+    const string& userName(uint32_t id) const { return userNames.get(id); }
+    size_t userCount() const { return userNames.size(); }
+
+    uint32_t internIsbn(string_view isbn) {
+        uint32_t id = findIsbn(isbn);
+        if (id != NO_ID) {
+            return id;
+        }
+        auto& stripe = isbnIds.of(isbn);
+        unique_lock<shared_mutex> guard(stripe.lock);
+        const uint32_t* existing = stripe.map.find(isbn);
+        if (existing != nullptr) {
+            return *existing; // Interned by another thread in the meantime
+        }
+        lock_guard<mutex> append(isbnAppendLock);
+        id = static_cast<uint32_t>(isbnTexts.size());
+        isbnTexts.push_back(string(isbn));
+        stripe.map.insert(isbn, id);
+        return id;
+    }
+
+    uint32_t findIsbn(string_view isbn) const {
+        auto& stripe = isbnIds.of(isbn);
+        shared_lock<shared_mutex> guard(stripe.lock);
+        const uint32_t* id = stripe.map.find(isbn);
+        return id != nullptr ? *id : NO_ID;
+    }
+
+    const string& isbn(uint32_t id) const { return isbnTexts[id]; }
+    size_t isbnCount() const { return isbnTexts.size(); }
+
+    void clear() {
+        userNames.clear();
+        for (auto& stripe : isbnIds) {
+            unique_lock<shared_mutex> guard(stripe.lock);
+            stripe.map.clear();
+        }
+        isbnTexts.clear();
+    }
+};
+
+// Record archive file format: a sequence of segments, each holding one chunk of
+// returned records moved out of the record store, and never changed once written.
+// A segment is a header, then the chunk's distinct user ids (sorted, with each user's
+// newest record in the chunk and the fine days of their late returns there) and
+// distinct book ids, then one bit-packed column per field. Users and books are stored
+// as indexes into those dictionaries; borrow dates as offsets from the chunk's
+// earliest, due dates from the borrow date and return dates from the due date; the
+// previous record of the same user as the distance back to it. Each column keeps the
+// smallest value as its base and packs the rest in as few bits as the largest needs,
+// so any row decodes in place, without unpacking the rest of the chunk.
+const char ARCHIVE_MAGIC[4] = {'L', 'M', 'S', 'A'};
+const uint32_t ARCHIVE_VERSION = 1;
+
+// RecordArchive class: the archive file of a record store, memory-mapped. Appends
+// go to the end of the file and are made durable with one fsync; a segment that an
+// interrupted append left torn fails its checksum, and is cut off before the next
+// append. Reads are lock-free; the record store keeps remap() apart from them.
+class RecordArchive {
+public:
+    static const uint32_t NO_PREVIOUS = static_cast<uint32_t>(-1);
+
+    // One archived record, with the ids of the library's Identifiers
+    struct Row {
+        uint32_t user, book, previous;
+        time_t borrowDate, dueDate, returnDate;
+    };
+
+private:
+    enum Column { UserCodes, BookCodes, BorrowDates, DueDates, ReturnDates, Previous, COLUMN_COUNT };
+
+    // Value i of a column is base plus the i-th width-bit number packed into its
+    // 64-bit words, which start offset bytes into the segment
+    struct PackedColumn {
+        int64_t base;
+        uint32_t width;
+        uint32_t reserved;
+        uint64_t offset;
+    };
+
+    struct Segment {
+        char magic[4];
+        uint32_t version;
+        uint64_t chunk;
+        uint32_t rows, userCount, bookCount;
+        uint32_t checksum; // Journal::checksum of the size bytes after the header
+        uint64_t size;
+        PackedColumn columns[COLUMN_COUNT];
+        // Followed by u64 fine days, u32 user ids and u32 newest rows per user, then
+        // u32 book ids, padded to 8 bytes, then the columns' words
+    };
+
+    string path;
+    unique_ptr<MappedFile> file;
+    vector<const char*> segments; // Chunk -> its segment in the mapping, or null
+    uint64_t validEnd = 0;        // Length of the intact segments at the start of the file
+
+    static const Segment& header(const char* segment) { return *reinterpret_cast<const Segment*>(segment); }
+
+    static const uint64_t* userFineDays(const char* segment) {
+        return reinterpret_cast<const uint64_t*>(segment + sizeof(Segment));
+    }
+    static const uint32_t* userIds(const char* segment) {
+        return reinterpret_cast<const uint32_t*>(userFineDays(segment) + header(segment).userCount);
+    }
+    static const uint32_t* userLatest(const char* segment) { return userIds(segment) + header(segment).userCount; }
+    static const uint32_t* bookIds(const char* segment) { return userLatest(segment) + header(segment).userCount; }
+
+    static uint64_t dictionaryEnd(const Segment& h) {
+        uint64_t end = sizeof(Segment) + 16 * uint64_t(h.userCount) + 4 * uint64_t(h.bookCount);
+        return (end + 7) & ~uint64_t(7);
+    }
+
+    static uint64_t wordCount(size_t rows, uint32_t width) { return (uint64_t(rows) * width + 63) / 64; }
+
+    static uint64_t unpack(const char* words, uint32_t width, size_t i) {
+        if (width == 0) {
+            return 0;
+        }
+        uint64_t bit = uint64_t(i) * width, value;
+        memcpy(&value, words + (bit >> 6) * 8, sizeof(value));
+        unsigned shift = bit & 63;
+        value >>= shift;
+        if (shift + width > 64) {
+            uint64_t high;
+            memcpy(&high, words + ((bit >> 6) + 1) * 8, sizeof(high));
+            value |= high << (64 - shift);
+        }
+        return width == 64 ? value : value & ((uint64_t(1) << width) - 1);
+    }
+
+    static int64_t value(const char* segment, Column c, size_t i) {
+        const PackedColumn& column = header(segment).columns[c];
+        return column.base + static_cast<int64_t>(unpack(segment + column.offset, column.width, i));
+    }
+
+    // Every section of a segment lies inside it
+    static bool wellFormed(const Segment& h) {
+        uint64_t end = sizeof(Segment) + h.size;
+        if (dictionaryEnd(h) > end) {
+            return false;
+        }
+        for (const PackedColumn& column : h.columns) {
+            if (column.width > 64 || column.offset < dictionaryEnd(h) || column.offset > end ||
+                wordCount(h.rows, column.width) * 8 > end - column.offset) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Indexes the intact segments of the mapping, stopping at the first damaged one.
+    // A later segment for a chunk replaces an earlier one.
+    void scan() {
+        segments.clear();
+        string_view data = file->view();
+        size_t pos = 0;
+        while (data.size() - pos >= sizeof(Segment)) {
+            const char* segment = data.data() + pos;
+            const Segment& h = header(segment);
+            if (memcmp(h.magic, ARCHIVE_MAGIC, sizeof(h.magic)) != 0 || h.version != ARCHIVE_VERSION ||
+                h.size > data.size() - pos - sizeof(Segment) || h.size % 8 != 0 ||
+                h.chunk >= ChunkedColumn<uint32_t>::MAX_CHUNKS || !wellFormed(h) ||
+                Journal::checksum(segment + sizeof(Segment), h.size) != h.checksum) {
+                break;
+            }
+            if (h.chunk >= segments.size()) {
+                segments.resize(h.chunk + 1, nullptr);
+            }
+            segments[h.chunk] = segment;
+            pos += sizeof(Segment) + h.size;
+        }
+        validEnd = pos;
+    }
+
+public:
+    RecordArchive() {}
+    RecordArchive(const RecordArchive&) = delete;
+    RecordArchive& operator=(const RecordArchive&) = delete;
+
+    // Encodes the rows records of a chunk, starting at record id chunk * rows, as one
+    // segment and appends it to out. Every record must be returned.
+    static void encode(uint64_t chunk, size_t rows, const uint32_t* users, const uint32_t* books,
+                       const time_t* borrowDates, const time_t* dueDates, const time_t* returnDates,
+                       const uint8_t* returned, const uint32_t* previous, string& out) {
+        vector<uint32_t> userDict(users, users + rows), bookDict(books, books + rows);
+        sort(userDict.begin(), userDict.end());
+        userDict.erase(unique(userDict.begin(), userDict.end()), userDict.end());
+        sort(bookDict.begin(), bookDict.end());
+        bookDict.erase(unique(bookDict.begin(), bookDict.end()), bookDict.end());
+
+        vector<uint32_t> days(rows);
+        fineDaysOf(dueDates, returnDates, returned, 0, days.data(), rows);
+        vector<uint64_t> fineDays(userDict.size(), 0);
+        vector<uint32_t> latest(userDict.size(), 0);
+        vector<int64_t> values[COLUMN_COUNT];
+        for (auto& column : values) {
+            column.resize(rows);
+        }
+        uint64_t firstId = chunk * rows;
+        for (size_t i = 0; i < rows; i++) {
+            size_t user = lower_bound(userDict.begin(), userDict.end(), users[i]) - userDict.begin();
+            fineDays[user] += days[i];
+            latest[user] = static_cast<uint32_t>(i);
+            values[UserCodes][i] = user;
+            values[BookCodes][i] = lower_bound(bookDict.begin(), bookDict.end(), books[i]) - bookDict.begin();
+            values[BorrowDates][i] = borrowDates[i];
+            values[DueDates][i] = dueDates[i] - borrowDates[i];
+            values[ReturnDates][i] = returnDates[i] - dueDates[i];
+            values[Previous][i] = previous[i] == NO_PREVIOUS ? 0 : static_cast<int64_t>(firstId + i - previous[i]);
+        }
+
+        Segment h = {};
+        memcpy(h.magic, ARCHIVE_MAGIC, sizeof(h.magic));
+        h.version = ARCHIVE_VERSION;
+        h.chunk = chunk;
+        h.rows = static_cast<uint32_t>(rows);
+        h.userCount = static_cast<uint32_t>(userDict.size());
+        h.bookCount = static_cast<uint32_t>(bookDict.size());
+        string body;
+        body.append(reinterpret_cast<const char*>(fineDays.data()), fineDays.size() * sizeof(uint64_t));
+        body.append(reinterpret_cast<const char*>(userDict.data()), userDict.size() * sizeof(uint32_t));
+        body.append(reinterpret_cast<const char*>(latest.data()), latest.size() * sizeof(uint32_t));
+        body.append(reinterpret_cast<const char*>(bookDict.data()), bookDict.size() * sizeof(uint32_t));
+        body.resize(dictionaryEnd(h) - sizeof(Segment), '\0');
+        for (int c = 0; c < COLUMN_COUNT; c++) {
+            PackedColumn& column = h.columns[c];
+            column.base = rows > 0 ? *min_element(values[c].begin(), values[c].end()) : 0;
+            uint64_t span = 0;
+            for (int64_t v : values[c]) {
+                span = max(span, static_cast<uint64_t>(v) - static_cast<uint64_t>(column.base));
+            }
+            while (column.width < 64 && (span >> column.width) != 0) {
+                column.width++;
+            }
+            column.offset = sizeof(Segment) + body.size();
+            vector<uint64_t> words(wordCount(rows, column.width), 0);
+            for (size_t i = 0; i < rows && column.width > 0; i++) {
+                uint64_t packed = static_cast<uint64_t>(values[c][i]) - static_cast<uint64_t>(column.base);
+                uint64_t bit = uint64_t(i) * column.width;
+                unsigned shift = bit & 63;
+                words[bit >> 6] |= packed << shift;
+                if (shift + column.width > 64) {
+                    words[(bit >> 6) + 1] |= packed >> (64 - shift);
+                }
+            }
+            body.append(reinterpret_cast<const char*>(words.data()), words.size() * sizeof(uint64_t));
+        }
+        h.size = body.size();
+        h.checksum = Journal::checksum(body.data(), body.size());
+        out.append(reinterpret_cast<const char*>(&h), sizeof(h));
+        out += body;
+    }
+
+    // Opens the archive at archivePath; a missing file is an empty archive
+    void open(const string& archivePath) {
+        path = archivePath;
+        remap();
+    }
+
+    // Opens the archive at archivePath emptied, for a store whose records do not come from it
+    void reset(const string& archivePath) {
+        ofstream truncated(archivePath, ios::binary | ios::trunc);
+        truncated.close();
+        open(archivePath);
+    }
+
+    void close() {
+        file.reset();
+        segments.clear();
+        path.clear();
+        validEnd = 0;
+    }
+
+    bool isOpen() const { return !path.empty(); }
+
+    // Appends encoded segments and makes them durable; they are readable after the
+    // next remap(). A torn segment left at the end by an earlier append is cut off first.
+    bool append(const string& encoded) {
+        if (path.empty()) {
+            return false;
+        }
+#ifndef _WIN32
+        if (file->view().size() != validEnd && truncate(path.c_str(), validEnd) != 0) {
+            return false;
+        }
+#endif
+        FILE* out = fopen(path.c_str(), "ab");
+        if (out == nullptr) {
+            return false;
+        }
+        bool ok = fwrite(encoded.data(), 1, encoded.size(), out) == encoded.size() && fflush(out) == 0;
+#ifndef _WIN32
+        ok = ok && fdatasync(fileno(out)) == 0;
+#endif
+        return fclose(out) == 0 && ok;
+    }
+
+    // Bytes of the segments of the chunks keep(chunk) accepts
+    template <typename Keep>
+    uint64_t keptBytes(Keep keep) const {
+        uint64_t bytes = 0;
+        for (size_t c = 0; c < segments.size(); c++) {
+            if (segments[c] != nullptr && keep(c)) {
+                bytes += sizeof(Segment) + header(segments[c]).size;
+            }
+        }
+        return bytes;
+    }
+
+    // Rewrites the file with only the segments of the chunks keep(chunk) accepts, through
+    // a durable copy renamed over it, so a crash leaves either the old file or the new one
+    // whole. Reads go on from the old mapping until the next remap(). Returns false,
+    // leaving the file as it was, if the copy could not be written.
+    template <typename Keep>
+    bool compact(Keep keep) {
+        string tmpPath = path + ".tmp";
+        FILE* out = fopen(tmpPath.c_str(), "wb");
+        if (out == nullptr) {
+            return false;
+        }
+        bool ok = true;
+        for (size_t c = 0; c < segments.size() && ok; c++) {
+            if (segments[c] != nullptr && keep(c)) {
+                size_t bytes = sizeof(Segment) + header(segments[c]).size;
+                ok = fwrite(segments[c], 1, bytes, out) == bytes;
+            }
+        }
+        ok = ok && fflush(out) == 0;
+#ifndef _WIN32
+        ok = ok && fdatasync(fileno(out)) == 0;
+#endif
+        ok = fclose(out) == 0 && ok;
+        if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0) {
+            remove(tmpPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // Maps the file again, picking up appended segments. Invalidates every earlier read.
+    void remap() {
+        file.reset(new MappedFile(path));
+        scan();
+    }
+
+    // Records of the chunk in the archive, or 0 if it has none
+    size_t rows(size_t chunk) const {
+        return chunk < segments.size() && segments[chunk] != nullptr ? header(segments[chunk]).rows : 0;
+    }
+
+    // Every user and book id of the chunk is below the given counts
+    bool fits(size_t chunk, size_t userCount, size_t bookCount) const {
+        const char* segment = segments[chunk];
+        const Segment& h = header(segment);
+        return (h.userCount == 0 || userIds(segment)[h.userCount - 1] < userCount) &&
+               (h.bookCount == 0 || bookIds(segment)[h.bookCount - 1] < bookCount);
+    }
+
+    Row row(size_t chunk, size_t i) const {
+        const char* segment = segments[chunk];
+        const Segment& h = header(segment);
+        Row r;
+        r.user = userIds(segment)[value(segment, UserCodes, i)];
+        r.book = bookIds(segment)[value(segment, BookCodes, i)];
+        r.borrowDate = value(segment, BorrowDates, i);
+        r.dueDate = r.borrowDate + value(segment, DueDates, i);
+        r.returnDate = r.dueDate + value(segment, ReturnDates, i);
+        int64_t back = value(segment, Previous, i);
+        r.previous = back == 0 ? NO_PREVIOUS : static_cast<uint32_t>(h.chunk * h.rows + i - back);
+        return r;
+    }
+
+    // Calls fn(user, offset of their newest record in the chunk, fine days of their
+    // late returns in the chunk) for every user with records in the chunk
+    template <typename Fn>
+    void forEachUser(size_t chunk, Fn fn) const {
+        const char* segment = segments[chunk];
+        for (uint32_t u = 0; u < header(segment).userCount; u++) {
+            fn(userIds(segment)[u], userLatest(segment)[u], userFineDays(segment)[u]);
+        }
+    }
+
+    // Bytes of intact segments on disk
+    uint64_t size() const { return validEnd; }
+};
+
+// RecordStore class: the loan history as a struct of arrays. Each record is a row
+// across contiguous columns, addressed by its record id; users and books are
+// stored as dense ids from the library's Identifiers rather than per-record strings.
+// Open loans are also indexed by due date, by (user, book) and by user.
+// Safe to use from several threads without a store-wide lock: record ids are handed
+// out by an atomic counter, and the open-loan indexes are split into shards by user,
+// each with its own lock, so loans of different users rarely contend.
+// Old history is tiered out: a chunk of records that were all returned long ago moves
+// to the archive file and its columns are freed (see tier), so memory follows the
+// recent and open loans rather than all-time history. Reads of any record id work the
+// same either way.
+class RecordStore {
+public:
+    static const size_t SHARD_COUNT = 64;
+
+private:
+    // A return that a snapshot taken before it must still see as an open loan
+    struct RecentReturn {
+        uint64_t stamp;
+        time_t due;
+        size_t id;
+    };
+
+    // The open loans of the users that map to one shard
+    struct alignas(64) OpenShard {
+        mutable shared_mutex lock;
+        // Snapshots read byDue and recentReturns under dueLock alone, so changes to them
+        // hold it too (and, for byDue, the shard lock). It is a leaf: nothing else is
+        // locked while it is held.
+        mutable mutex dueLock;
+        set<pair<time_t, size_t>> byDue; // (due date, record id) of loans not yet returned
+        mutable deque<RecentReturn> recentReturns; // Returns some open snapshot may predate, in stamp order
+        unordered_map<uint64_t, vector<size_t>> byLoan; // loanKey(user, book) -> open record ids, oldest first
+        unordered_map<uint32_t, set<size_t>> byUser; // user -> open record ids, oldest first; a set keeps returns O(log n) for heavy borrowers
+        unordered_map<uint32_t, uint32_t> latest; // user -> id of their newest record, open or returned
+
+        // Report aggregates. Loans due before sweptTo are counted as overdue, with the
+        // fine days they had accrued by then; sweep() moves sweptTo forward. Reports
+        // only read these, so they are mutable like the lock.
+        mutable time_t sweptTo = 0;
+        mutable size_t overdueCount = 0;
+        mutable uint64_t accruingFineDays = 0;
+        mutable set<pair<time_t, size_t>> nextFineDay; // (when the next fine day accrues, id) of overdue loans
+        uint64_t returnedFineDays = 0; // Fine days of loans returned late
+        unordered_map<uint32_t, uint64_t> lateFineDays; // user -> fine days of their late returns, archived ones included
+    };
+
+    Identifiers& ids;
+    ChunkedColumn<uint32_t> userCol;
+    ChunkedColumn<uint32_t> bookCol;
+    ChunkedColumn<time_t> borrowCol;
+    ChunkedColumn<time_t> dueCol;
+    ChunkedColumn<time_t> returnCol;
+    ChunkedColumn<atomic<uint8_t>> returnedCol; // Set once, after returnCol, when a loan is returned
+    ChunkedColumn<uint64_t> stampCol; // Return stamp, written before returnedCol; 0 for loans loaded as returned
+    ChunkedColumn<uint32_t> previousCol; // Id of the same user's previous record, or NO_PREVIOUS
+
+    OpenShard shards[SHARD_COUNT];
+    atomic<size_t> nextId{0};    // Next record id to hand out
+    atomic<size_t> committed{0}; // Rows below this id are complete and visible
+    atomic<uint64_t> nextStamp{1};   // Next return stamp to hand out
+    atomic<uint64_t> stampsDone{0};  // Returns with stamps up to this one are complete
+    Journal* journal = nullptr; // Receives every change once attached; null while loading
+
+    // Archived chunks. Readers of the columns hold tierLock shared (see pinChunks), so
+    // tier() can take it exclusively to free the columns of chunks it archived. A thread
+    // holding it never waits for a shard lock; the other order is fine.
+    RecordArchive archive;
+    unique_ptr<atomic<uint8_t>[]> archivedChunks; // Set for chunks whose records are in the archive
+    size_t archivedCount = 0;          // Records in the archive
+    mutable shared_mutex tierLock;
+    mutable mutex tierGate; // Held by tier() while it waits for tierLock
+    mutex tierPassLock;     // One tier() at a time
+
+    // Stamps of the open snapshots, with how many were taken at each
+    mutable mutex snapshotLock;
+    mutable map<uint64_t, size_t> openSnapshots;
+
+    static_assert(sizeof(atomic<uint8_t>) == 1, "the returned column is stored as raw bytes");
+    static const uint32_t NO_PREVIOUS = RecordArchive::NO_PREVIOUS;
+    static const size_t CHUNK_BITS = ChunkedColumn<uint32_t>::CHUNK_BITS;
+    static constexpr size_t CHUNK_SIZE = ChunkedColumn<uint32_t>::CHUNK_SIZE;
+
+    // Links record id at the head of its user's chain of records. The caller holds the
+    // user's shard lock and publishes the row afterwards.
+    void chain(OpenShard& shard, size_t id) {
+        auto it = shard.latest.find(userCol[id]);
+        previousCol.slot(id) = it != shard.latest.end() ? it->second : NO_PREVIOUS;
+    }
+
+    static uint64_t loanKey(uint32_t user, uint32_t book) {
+        return (static_cast<uint64_t>(user) << 32) | book;
+    }
+
+    OpenShard& shardOf(uint32_t user) { return shards[user % SHARD_COUNT]; }
+    const OpenShard& shardOf(uint32_t user) const { return shards[user % SHARD_COUNT]; }
+
+    static void removeId(vector<size_t>& ids, size_t id) { ids.erase(std::find(ids.begin(), ids.end(), id)); }
+    static void removeId(set<size_t>& ids, size_t id) { ids.erase(id); }
+
+    template <typename Key, typename Ids>
+    static void eraseId(unordered_map<Key, Ids>& index, Key key, size_t id) {
+        auto it = index.find(key);
+        if (it == index.end()) {
+            return;
+        }
+        Ids& ids = it->second;
+        removeId(ids, id);
+        if (ids.empty()) {
+            index.erase(it);
+        }
+    }
+
+    // Whole days of fine owed at the given time for a loan due then (as Fine counts them)
+    static uint64_t fineDays(time_t due, time_t at) {
+        return at > due ? static_cast<uint64_t>((at - due) / (24 * 60 * 60)) : 0;
+    }
+
+    // Counts a returned loan's fine days for its user. The caller holds the user's shard lock.
+    static void addReturnedFine(OpenShard& shard, uint32_t user, uint64_t days) {
+        if (days != 0) {
+            shard.returnedFineDays += days;
+            shard.lateFineDays[user] += days;
+        }
+    }
+
+    // Counts an open loan as overdue in the shard's aggregates. The caller holds its lock.
+    static void addOverdue(const OpenShard& shard, size_t id, time_t due) {
+        uint64_t days = fineDays(due, shard.sweptTo);
+        shard.overdueCount++;
+        shard.accruingFineDays += days;
+        shard.nextFineDay.insert(make_pair(due + static_cast<time_t>(days + 1) * 24 * 60 * 60, id));
+    }
+
+    static void removeOverdue(const OpenShard& shard, size_t id, time_t due) {
+        uint64_t days = fineDays(due, shard.sweptTo);
+        shard.overdueCount--;
+        shard.accruingFineDays -= days;
+        shard.nextFineDay.erase(make_pair(due + static_cast<time_t>(days + 1) * 24 * 60 * 60, id));
+    }
+
+    // Brings the shard's aggregates forward to now: loans that fell due since the last
+    // sweep become overdue, and overdue loans that crossed another day accrue fine days.
+    // Each loan is visited once when it falls due and at most once a day after that.
+    // A clock that went backwards leaves the aggregates as they were. The caller holds
+    // the shard's lock exclusively.
+    void sweep(const OpenShard& shard, time_t now) const {
+        if (now <= shard.sweptTo) {
+            return;
+        }
+        auto due = shard.byDue.lower_bound(make_pair(shard.sweptTo, size_t(0)));
+        for (; due != shard.byDue.end() && due->first < now; ++due) {
+            shard.overdueCount++;
+            shard.nextFineDay.insert(make_pair(due->first + 24 * 60 * 60, due->second));
+        }
+        while (!shard.nextFineDay.empty() && shard.nextFineDay.begin()->first <= now) {
+            pair<time_t, size_t> next = *shard.nextFineDay.begin();
+            shard.nextFineDay.erase(shard.nextFineDay.begin());
+            time_t dueDate = dueCol[next.second];
+            uint64_t counted = fineDays(dueDate, next.first) - 1, days = fineDays(dueDate, now);
+            shard.accruingFineDays += days - counted;
+            shard.nextFineDay.insert(make_pair(dueDate + static_cast<time_t>(days + 1) * 24 * 60 * 60, next.second));
+        }
+        shard.sweptTo = now;
+    }
+
+    // The caller holds the shard's lock
+    void indexOpen(OpenShard& shard, size_t id) {
+        {
+            lock_guard<mutex> due(shard.dueLock);
+            shard.byDue.insert(make_pair(dueCol[id], id));
+        }
+        shard.byLoan[loanKey(userCol[id], bookCol[id])].push_back(id);
+        shard.byUser[userCol[id]].insert(id);
+        if (dueCol[id] < shard.sweptTo) {
+            addOverdue(shard, id, dueCol[id]);
+        }
+    }
+
+    // Holds tierLock shared. Readers queue behind a tier() waiting for it, so a steady
+    // stream of overlapping readers cannot keep it out; a thread must not pin twice.
+    shared_lock<shared_mutex> pinChunks() const {
+        lock_guard<mutex> wait(tierGate);
+        return shared_lock<shared_mutex>(tierLock);
+    }
+
+    // Record id from the archive; the caller holds tierLock
+    BorrowRecord archivedRecord(size_t id) const {
+        RecordArchive::Row row = archive.row(id >> CHUNK_BITS, id & (CHUNK_SIZE - 1));
+        return BorrowRecord(&ids.userName(row.user), &ids.isbn(row.book), row.borrowDate, row.dueDate,
+                            row.returnDate, true);
+    }
+
+    // The caller holds tierLock
+    uint32_t userOf(size_t id) const {
+        return isArchived(id) ? archive.row(id >> CHUNK_BITS, id & (CHUNK_SIZE - 1)).user : userCol[id];
+    }
+    uint32_t previousOf(size_t id) const {
+        return isArchived(id) ? archive.row(id >> CHUNK_BITS, id & (CHUNK_SIZE - 1)).previous : previousCol[id];
+    }
+
+    // Every loan of chunk c was returned before the given time, with its return complete
+    bool archivable(size_t c, time_t before, uint64_t stamp) const {
+        const atomic<uint8_t>* returned = returnedCol.chunk(c);
+        const time_t* returnDates = returnCol.chunk(c);
+        const uint64_t* stamps = stampCol.chunk(c);
+        for (size_t i = 0; i < CHUNK_SIZE; i++) {
+            if (!returned[i].load(memory_order_acquire) || stamps[i] > stamp || returnDates[i] >= before) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // The caller holds tierLock exclusively, or no other thread is using the store
+    void markArchived(size_t c) {
+        archivedChunks[c].store(1, memory_order_release);
+        archivedCount += CHUNK_SIZE;
+    }
+
+    // Allocates every column's chunk for row id
+    void prepareRow(size_t id) {
+        userCol.prepare(id);
+        bookCol.prepare(id);
+        borrowCol.prepare(id);
+        dueCol.prepare(id);
+        returnCol.prepare(id);
+        returnedCol.prepare(id);
+        stampCol.prepare(id);
+        previousCol.prepare(id);
+    }
+
+    // Returns up to this stamp are visible to every open snapshot and to every one that
+    // can still be taken, so recentReturns need not keep them: the stamp of the oldest
+    // open snapshot, or with none open, the last completed return.
+    uint64_t settledStamp() const {
+        lock_guard<mutex> guard(snapshotLock);
+        return openSnapshots.empty() ? stampsDone.load(memory_order_acquire) : openSnapshots.begin()->first;
+    }
+
+    // The caller holds the shard's dueLock
+    static void trimReturns(const OpenShard& shard, uint64_t settled) {
+        while (!shard.recentReturns.empty() && shard.recentReturns.front().stamp <= settled) {
+            shard.recentReturns.pop_front();
+        }
+    }
+
+    // Forgets a snapshot once it is gone; if it was the oldest, every shard drops the
+    // returns only it still needed
+    void releaseSnapshot(uint64_t stamp) const {
+        uint64_t settled;
+        {
+            lock_guard<mutex> guard(snapshotLock);
+            auto it = openSnapshots.find(stamp);
+            if (--it->second != 0) {
+                return;
+            }
+            bool oldest = it == openSnapshots.begin();
+            openSnapshots.erase(it);
+            if (!oldest) {
+                return;
+            }
+            settled = openSnapshots.empty() ? stampsDone.load(memory_order_acquire) : openSnapshots.begin()->first;
+        }
+        for (const auto& shard : shards) {
+            lock_guard<mutex> due(shard.dueLock);
+            trimReturns(shard, settled);
+        }
+    }
+
+    void publish(size_t n) {
+        userCol.publish(n);
+        bookCol.publish(n);
+        borrowCol.publish(n);
+        dueCol.publish(n);
+        returnCol.publish(n);
+        returnedCol.publish(n);
+        stampCol.publish(n);
+        previousCol.publish(n);
+        committed.store(n, memory_order_release);
+    }
+
+public:
+    explicit RecordStore(Identifiers& identifiers)
+        : ids(identifiers), archivedChunks(new atomic<uint8_t>[ChunkedColumn<uint32_t>::MAX_CHUNKS]()) {}
+    RecordStore(const RecordStore&) = delete;
+    RecordStore& operator=(const RecordStore&) = delete;
+
+    // Appends a record and returns its id. The due date follows from the borrow date.
+    size_t add(const string& userId, const string& isbn, time_t borrowDate,
+               bool returned = false, time_t returnDate = 0) {
+        uint32_t user = ids.internUser(userId);
+        uint32_t book = ids.internIsbn(isbn);
+        OpenShard& shard = shardOf(user);
+        unique_lock<shared_mutex> guard(shard.lock);
+        // Later writers wait for this row to be published, so it claims its id only once
+        // its column chunks exist and its journal entry is encoded; if either throws, no
+        // id is taken. A lost race for the id redoes both for the next one.
+        Journal::Frame issued;
+        size_t id = nextId.load(memory_order_acquire);
+        do {
+            prepareRow(id);
+            if (!returned && journal != nullptr) {
+                issued = Journal::encode({JournalOp::Issue, {userId, isbn}, {static_cast<int64_t>(id), borrowDate}});
+            }
+        } while (!nextId.compare_exchange_weak(id, id + 1, memory_order_acq_rel));
+        userCol.slot(id) = user;
+        bookCol.slot(id) = book;
+        borrowCol.slot(id) = borrowDate;
+        dueCol.slot(id) = borrowDate + (BORROW_DAYS * 24 * 60 * 60);
+        returnCol.slot(id) = returned ? returnDate : 0;
+        returnedCol.slot(id).store(returned ? 1 : 0, memory_order_relaxed);
+        stampCol.slot(id) = 0;
+        chain(shard, id);
+
+        // Rows are published in id order, so size() only ever covers complete rows and
+        // the journal lists issues in id order, as replay expects. Only threads that
+        // already hold their own shard wait here, and only for the few ids ahead of them.
+        while (committed.load(memory_order_acquire) != id) {
+            this_thread::yield();
+        }
+        if (!issued.empty()) {
+            journal->append(issued);
+        }
+        // Indexed before it is published, so a snapshot that sees the row sees it as open.
+        // The indexes allocate; if they throw, the row is still published and the error
+        // passes on, so the writers behind it are never left waiting.
+        try {
+            if (!returned) {
+                indexOpen(shard, id);
+            } else {
+                addReturnedFine(shard, user, fineDays(dueCol[id], returnDate));
+            }
+            shard.latest[user] = static_cast<uint32_t>(id);
+        } catch (...) {
+            publish(id + 1);
+            throw;
+        }
+        publish(id + 1);
+        return id;
+    }
+
+    // Bulk-appends count records whose user and book ids are already interned
+    // in the library's Identifiers; used by bulk loads, with no other threads using the store
+    void appendColumns(size_t count, const uint32_t* users, const uint32_t* books, const time_t* borrowDates,
+                       const time_t* dueDates, const time_t* returnDates, const uint8_t* returnedFlags) {
+        size_t first = size();
+        userCol.append(users, count);
+        bookCol.append(books, count);
+        borrowCol.append(borrowDates, count);
+        dueCol.append(dueDates, count);
+        returnCol.append(returnDates, count);
+        returnedCol.append(reinterpret_cast<const atomic<uint8_t>*>(returnedFlags), count);
+        for (size_t id = first; id < first + count; id++) {
+            OpenShard& shard = shardOf(userCol[id]);
+            stampCol.slot(id) = 0;
+            chain(shard, id);
+            shard.latest[userCol[id]] = static_cast<uint32_t>(id);
+        }
+        nextId = first + count;
+        publish(first + count);
+        for (size_t id = first; id < first + count; id++) {
+            if (!returnedCol[id].load(memory_order_relaxed)) {
+                indexOpen(shardOf(userCol[id]), id);
+            } else {
+                addReturnedFine(shardOf(userCol[id]), userCol[id], fineDays(dueCol[id], returnCol[id]));
+            }
+        }
+    }
+
+    // Opens the archive file for a store about to be bulk loaded, keeping what it holds
+    // for the snapshot that refers to it, or, with reset, emptying it for a store loaded
+    // from text files that hold every record in it. Bulk loads only.
+    void openArchive(const string& path, bool reset) {
+        if (reset) {
+            archive.reset(path);
+        } else {
+            archive.open(path);
+        }
+    }
+
+    // Whether the archive file at path holds each of the count chunks listed whole, with
+    // user and book ids below the given counts; checks a snapshot before it replaces anything
+    static bool archiveHolds(const string& path, const uint64_t* chunks, size_t count, size_t userCount,
+                             size_t bookCount) {
+        RecordArchive archive;
+        archive.open(path);
+        for (size_t i = 0; i < count; i++) {
+            if (archive.rows(chunks[i]) != CHUNK_SIZE || !archive.fits(chunks[i], userCount, bookCount)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Whether the archive file at path holds no records
+    static bool archiveEmpty(const string& path) {
+        RecordArchive archive;
+        archive.open(path);
+        return archive.size() == 0;
+    }
+
+    // Appends the next chunk of records from the archive instead of from columns; for
+    // bulk loads, at a chunk boundary. Only each user's newest record and fine days are
+    // read, not the rows. Returns false if the archive does not hold that chunk whole.
+    bool appendArchived() {
+        size_t first = size();
+        size_t c = first >> CHUNK_BITS;
+        if ((first & (CHUNK_SIZE - 1)) != 0 || archive.rows(c) != CHUNK_SIZE ||
+            !archive.fits(c, ids.userCount(), ids.isbnCount())) {
+            return false;
+        }
+        userCol.skipChunk();
+        bookCol.skipChunk();
+        borrowCol.skipChunk();
+        dueCol.skipChunk();
+        returnCol.skipChunk();
+        returnedCol.skipChunk();
+        stampCol.skipChunk();
+        previousCol.skipChunk();
+        archive.forEachUser(c, [this, first](uint32_t user, uint32_t latest, uint64_t days) {
+            OpenShard& shard = shardOf(user);
+            shard.latest[user] = static_cast<uint32_t>(first + latest);
+            addReturnedFine(shard, user, days);
+        });
+        markArchived(c);
+        nextId = first + CHUNK_SIZE;
+        publish(first + CHUNK_SIZE);
+        return true;
+    }
+
+    const Identifiers& getIdentifiers() const { return ids; }
+
+    // Whether the record is in the archive rather than the columns. Stable while the
+    // caller holds a snapshot, and for records that were open since it last looked.
+    bool isArchived(size_t id) const { return archivedChunks[id >> CHUNK_BITS].load(memory_order_acquire) != 0; }
+
+    // Pre-sizes the history for a bulk load
+    void reserve(size_t count) {
+        userCol.reserve(count);
+        bookCol.reserve(count);
+        borrowCol.reserve(count);
+        dueCol.reserve(count);
+        returnCol.reserve(count);
+        returnedCol.reserve(count);
+        stampCol.reserve(count);
+        previousCol.reserve(count);
+    }
+
+    BorrowRecord get(size_t id) const {
+        shared_lock<shared_mutex> pin = pinChunks();
+        if (isArchived(id)) {
+            return archivedRecord(id);
+        }
+        bool returned = returnedCol[id].load(memory_order_acquire) != 0;
+        return BorrowRecord(&ids.userName(userCol[id]), &ids.isbn(bookCol[id]), borrowCol[id],
+                            dueCol[id], returned ? returnCol[id] : 0, returned);
+    }
+
+    // Marks an open loan as returned and drops it from the open-loan indexes.
+    // Returns false if it was already returned, so of two threads returning the
+    // same loan exactly one succeeds. Archived loans were returned at least a day
+    // before they moved, so a loan open when its id was looked up is never archived
+    // under a close.
+    bool close(size_t id, time_t returnDate) {
+        if (isArchived(id)) {
+            return false;
+        }
+        uint32_t user = userCol[id];
+        OpenShard& shard = shardOf(user);
+        unique_lock<shared_mutex> guard(shard.lock);
+        auto it = shard.byUser.find(user);
+        if (it == shard.byUser.end() || it->second.count(id) == 0) {
+            return false;
+        }
+        // Returns wait for earlier stamps to complete, so everything that can throw comes
+        // before the stamp is taken: the journal entry and the room for the return in
+        // lateFineDays and recentReturns. From there on nothing allocates.
+        time_t due = dueCol[id];
+        uint64_t days = fineDays(due, returnDate);
+        Journal::Frame closed;
+        if (journal != nullptr) {
+            closed = Journal::encode({JournalOp::Return, {}, {static_cast<int64_t>(id), returnDate}});
+        }
+        if (days != 0) {
+            shard.lateFineDays.emplace(user, 0);
+        }
+        uint64_t settled = settledStamp();
+        uint64_t stamp;
+        {
+            lock_guard<mutex> dueGuard(shard.dueLock);
+            trimReturns(shard, settled);
+            shard.recentReturns.push_back({0, due, id});
+            stamp = nextStamp.fetch_add(1);
+            shard.recentReturns.back().stamp = stamp;
+            shard.byDue.erase(make_pair(due, id));
+        }
+        it->second.erase(id);
+        if (it->second.empty()) {
+            shard.byUser.erase(it);
+        }
+        if (due < shard.sweptTo) {
+            removeOverdue(shard, id, due);
+        }
+        addReturnedFine(shard, user, days);
+        eraseId(shard.byLoan, loanKey(user, bookCol[id]), id);
+        returnCol[id] = returnDate;
+        stampCol[id] = stamp;
+        returnedCol[id].store(1, memory_order_release);
+        if (!closed.empty()) {
+            journal->append(closed);
+        }
+        // Stamps complete in order, so a snapshot never sees a later return without an
+        // earlier one; as in add, only threads already holding a shard wait here
+        while (stampsDone.load(memory_order_acquire) != stamp - 1) {
+            this_thread::yield();
+        }
+        stampsDone.store(stamp, memory_order_release);
+        return true;
+    }
+
+    // Snapshot class: a point-in-time view of the records. It sees the rows committed
+    // when it was taken, each loan returned or open as it was then, and nothing that
+    // came later. Reads go straight to the columns without locks, so a long report
+    // or listing never holds up an issue or a return; it only keeps tier() from
+    // moving chunks to the archive, and the shards from dropping the returns made
+    // since it was taken, until it is gone.
+    class Snapshot {
+    private:
+        const RecordStore* store; // Null once moved from
+        shared_lock<shared_mutex> pin; // On the store's tierLock
+        uint64_t stamp; // Returns with stamps up to this one are visible
+        size_t rows;
+
+    public:
+        // The store has counted it among its open snapshots
+        Snapshot(const RecordStore* s, shared_lock<shared_mutex> held, uint64_t st, size_t n)
+            : store(s), pin(std::move(held)), stamp(st), rows(n) {}
+        Snapshot(Snapshot&& other) noexcept
+            : store(other.store), pin(std::move(other.pin)), stamp(other.stamp), rows(other.rows) {
+            other.store = nullptr;
+        }
+        Snapshot& operator=(Snapshot&&) = delete;
+
+        // Destructor
+        ~Snapshot() {
+            if (store != nullptr) {
+                store->releaseSnapshot(stamp);
+            }
+        }
+
+        size_t size() const { return rows; }
+
+        // Archived loans were all returned before any snapshot that sees them as archived
+        bool isReturned(size_t id) const {
+            return store->isArchived(id) ||
+                   (store->returnedCol[id].load(memory_order_acquire) != 0 && store->stampCol[id] <= stamp);
+        }
+
+        BorrowRecord get(size_t id) const {
+            if (store->isArchived(id)) {
+                return store->archivedRecord(id);
+            }
+            bool returned = isReturned(id);
+            return BorrowRecord(&store->ids.userName(store->userCol[id]), &store->ids.isbn(store->bookCol[id]),
+                                store->borrowCol[id], store->dueCol[id], returned ? store->returnCol[id] : 0, returned);
+        }
+
+        // Loans open in the snapshot and due before now, most overdue first: the loans
+        // still open, from each shard's due-date index, less those issued since, plus
+        // those returned since. O(log n + k log k + returns since the snapshot was taken)
+        // for k overdue loans, however old the oldest open loan is.
+        vector<size_t> overdue(time_t now) const {
+            vector<pair<time_t, size_t>> due;
+            for (const auto& shard : store->shards) {
+                lock_guard<mutex> guard(shard.dueLock);
+                for (auto it = shard.byDue.begin(); it != shard.byDue.end() && it->first < now; ++it) {
+                    if (it->second < rows) {
+                        due.push_back(*it);
+                    }
+                }
+                auto since = upper_bound(shard.recentReturns.begin(), shard.recentReturns.end(), stamp,
+                                         [](uint64_t s, const RecentReturn& r) { return s < r.stamp; });
+                for (; since != shard.recentReturns.end(); ++since) {
+                    if (since->due < now && since->id < rows) {
+                        due.push_back(make_pair(since->due, since->id));
+                    }
+                }
+            }
+            sort(due.begin(), due.end());
+            vector<size_t> ids;
+            ids.reserve(due.size());
+            for (const auto& entry : due) {
+                ids.push_back(entry.second);
+            }
+            return ids;
+        }
+    };
+
+    // The stamp is read before the row count, so every visible return has a visible row.
+    // It is read and counted under snapshotLock, so no return it needs is trimmed first.
+    Snapshot snapshot() const {
+        shared_lock<shared_mutex> pin = pinChunks();
+        uint64_t stamp;
+        {
+            lock_guard<mutex> guard(snapshotLock);
+            stamp = stampsDone.load(memory_order_acquire);
+            openSnapshots[stamp]++;
+        }
+        return Snapshot(this, std::move(pin), stamp, size());
+    }
+
+    void setJournal(Journal* j) { journal = j; }
+
+    // Id of the oldest open loan of this book by this user, or NO_RECORD.
+    // Constant time regardless of how much history is stored.
+    size_t findOpen(const string& userId, const string& isbn) const {
+        uint32_t user = ids.findUser(userId);
+        uint32_t book = ids.findIsbn(isbn);
+        if (user == Identifiers::NO_ID || book == Identifiers::NO_ID) {
+            return NO_RECORD;
+        }
+        const OpenShard& shard = shardOf(user);
+        shared_lock<shared_mutex> guard(shard.lock);
+        auto it = shard.byLoan.find(loanKey(user, book));
+        return it != shard.byLoan.end() ? it->second.front() : NO_RECORD;
+    }
+
+    // Ids of the user's open loans, oldest first
+    vector<size_t> openLoansOf(const string& userId) const {
+        uint32_t user = ids.findUser(userId);
+        if (user == Identifiers::NO_ID) {
+            return {};
+        }
+        const OpenShard& shard = shardOf(user);
+        shared_lock<shared_mutex> guard(shard.lock);
+        auto it = shard.byUser.find(user);
+        return it != shard.byUser.end() ? vector<size_t>(it->second.begin(), it->second.end()) : vector<size_t>();
+    }
+
+    // Up to limit of the user's records, newest first, continuing after the record with id
+    // cursor (NO_RECORD starts from the newest). Pass the last id of a page to get the
+    // next one. Follows the user's chain of records, so only the rows on the page are
+    // read, however long the history; a cursor that is not one of the user's records
+    // gives an empty page.
+    vector<size_t> history(const string& userId, size_t cursor, size_t limit) const {
+        vector<size_t> page;
+        uint32_t user = ids.findUser(userId);
+        if (user == Identifiers::NO_ID) {
+            return page;
+        }
+        uint32_t id = NO_PREVIOUS;
+        if (cursor == NO_RECORD) {
+            const OpenShard& shard = shardOf(user);
+            shared_lock<shared_mutex> guard(shard.lock);
+            auto it = shard.latest.find(user);
+            if (it == shard.latest.end()) {
+                return page;
+            }
+            id = it->second;
+        }
+        shared_lock<shared_mutex> pin = pinChunks(); // Taken after the shard lock is released
+        if (cursor != NO_RECORD) {
+            if (cursor >= size() || userOf(cursor) != user) {
+                return page;
+            }
+            id = previousOf(cursor);
+        }
+        while (id != NO_PREVIOUS && page.size() < limit) {
+            page.push_back(id);
+            id = previousOf(id);
+        }
+        return page;
+    }
+
+    // Fine days owed by each user id as of now, over all of their loans: late returns,
+    // archived ones included, from the totals each shard keeps per user, and open loans
+    // past due from the shards' due-date indexes. O(users with fines + overdue loans),
+    // not the history; each shard holds up issues and returns only while its own loans
+    // are read.
+    vector<uint64_t> fineDaysByUser(time_t now) const {
+        vector<uint64_t> owed(ids.userCount(), 0);
+        auto owe = [&owed](uint32_t user, uint64_t days) {
+            if (user >= owed.size()) {
+                owed.resize(user + 1, 0); // Registered since the pass started
+            }
+            owed[user] += days;
+        };
+        for (const auto& shard : shards) {
+            shared_lock<shared_mutex> guard(shard.lock);
+            for (const auto& late : shard.lateFineDays) {
+                owe(late.first, late.second);
+            }
+            for (auto it = shard.byDue.begin(); it != shard.byDue.end() && it->first < now; ++it) {
+                owe(userCol[it->second], fineDays(it->first, now));
+            }
+        }
+        return owed;
+    }
+
+    // Open loans due before now, most overdue first: O(k log k) for k overdue loans
+    vector<size_t> overdue(time_t now) const {
+        vector<pair<time_t, size_t>> due;
+        for (const auto& shard : shards) {
+            shared_lock<shared_mutex> guard(shard.lock);
+            for (auto it = shard.byDue.begin(); it != shard.byDue.end() && it->first < now; ++it) {
+                due.push_back(*it);
+            }
+        }
+        sort(due.begin(), due.end());
+        vector<size_t> ids;
+        ids.reserve(due.size());
+        for (const auto& entry : due) {
+            ids.push_back(entry.second);
+        }
+        return ids;
+    }
+
+    // Live aggregates for reports
+    struct Totals {
+        size_t open = 0;
+        size_t overdue = 0;
+        uint64_t returnedFineDays = 0; // Fine days of loans that came back late
+        uint64_t accruingFineDays = 0; // Fine days accrued so far by loans still out
+    };
+
+    // Aggregates as of now, without looking at the history: each shard is swept
+    // forward (see sweep) and its counters added up
+    Totals totals(time_t now) const {
+        Totals sum;
+        for (const auto& shard : shards) {
+            unique_lock<shared_mutex> guard(shard.lock);
+            sweep(shard, now);
+            sum.open += shard.byDue.size();
+            sum.overdue += shard.overdueCount;
+            sum.returnedFineDays += shard.returnedFineDays;
+            sum.accruingFineDays += shard.accruingFineDays;
+        }
+        return sum;
+    }
+
+    size_t countOpen() const {
+        size_t count = 0;
+        for (const auto& shard : shards) {
+            shared_lock<shared_mutex> guard(shard.lock);
+            count += shard.byDue.size();
+        }
+        return count;
+    }
+
+    // Moves every full chunk of records that were all returned before the given time to
+    // the archive, frees its columns, and returns how many records moved. A chunk with
+    // even one loan still open, or returned since, stays whole in memory. The chunks are
+    // encoded and written while issues, returns and readers carry on; only the switch
+    // to the archive waits for snapshots and history reads in progress. Moves nothing
+    // until openArchive(). Either way it then drops the recent returns that every
+    // snapshot sees (see Snapshot::overdue), as returns and released snapshots also do.
+    size_t tier(time_t before) {
+        lock_guard<mutex> pass(tierPassLock);
+        uint64_t stamp = stampsDone.load(memory_order_acquire);
+        string encoded;
+        vector<size_t> moving;
+        for (size_t c = 0; archive.isOpen() && c < (size() >> CHUNK_BITS); c++) {
+            // A chunk the file already has a segment for, left there by a store loaded from
+            // text files, stays in memory: a snapshot on disk may still refer to that segment.
+            // The save that replaces that snapshot drops the segment (see compactArchive).
+            if (isArchived(c << CHUNK_BITS) || archive.rows(c) != 0 || !archivable(c, before, stamp)) {
+                continue;
+            }
+            RecordArchive::encode(c, CHUNK_SIZE, userCol.chunk(c), bookCol.chunk(c), borrowCol.chunk(c),
+                                  dueCol.chunk(c), returnCol.chunk(c),
+                                  reinterpret_cast<const uint8_t*>(returnedCol.chunk(c)), previousCol.chunk(c),
+                                  encoded);
+            moving.push_back(c);
+        }
+        if (!moving.empty() && !archive.append(encoded)) {
+            moving.clear();
+        }
+        size_t moved = 0;
+        uint64_t seen;
+        {
+            lock_guard<mutex> gate(tierGate);
+            unique_lock<shared_mutex> guard(tierLock);
+            // No snapshot is open, and every later one sees the returns done by now
+            seen = stampsDone.load(memory_order_acquire);
+            if (!moving.empty()) {
+                archive.remap();
+            }
+            for (size_t c : moving) {
+                if (archive.rows(c) != CHUNK_SIZE) {
+                    continue; // Unreadable after all; the columns stay
+                }
+                markArchived(c);
+                userCol.release(c);
+                bookCol.release(c);
+                borrowCol.release(c);
+                dueCol.release(c);
+                returnCol.release(c);
+                returnedCol.release(c);
+                stampCol.release(c);
+                previousCol.release(c);
+                moved += CHUNK_SIZE;
+            }
+        }
+        for (auto& shard : shards) {
+            lock_guard<mutex> due(shard.dueLock);
+            trimReturns(shard, seen);
+        }
+        return moved;
+    }
+
+    // Rewrites the archive without the segments of chunks the store has not archived:
+    // ones a text import left behind, and the older copies of any chunk. Call it only once
+    // a saved snapshot lists the store's archived chunks, as then nothing on disk refers to
+    // the others. The copy is written while readers carry on; only the remap waits for them.
+    void compactArchive() {
+        lock_guard<mutex> pass(tierPassLock);
+        auto kept = [this](size_t c) { return archivedChunks[c].load(memory_order_acquire) != 0; };
+        if (!archive.isOpen() || archive.keptBytes(kept) == archive.size() || !archive.compact(kept)) {
+            return;
+        }
+        lock_guard<mutex> gate(tierGate);
+        unique_lock<shared_mutex> guard(tierLock);
+        archive.remap();
+    }
+
+    // Records in the archive, and the archive's size on disk
+    size_t countArchived() const {
+        shared_lock<shared_mutex> pin = pinChunks();
+        return archivedCount;
+    }
+
+    uint64_t archiveBytes() const {
+        shared_lock<shared_mutex> pin = pinChunks();
+        return archive.size();
+    }
+
+    // Not safe against concurrent readers or writers
+    void clear() {
+        userCol.clear();
+        bookCol.clear();
+        borrowCol.clear();
+        dueCol.clear();
+        returnCol.clear();
+        returnedCol.clear();
+        stampCol.clear();
+        previousCol.clear();
+        for (auto& shard : shards) {
+            unique_lock<shared_mutex> guard(shard.lock);
+            shard.byDue.clear();
+            shard.recentReturns.clear();
+            shard.byLoan.clear();
+            shard.byUser.clear();
+            shard.latest.clear();
+            shard.sweptTo = 0;
+            shard.overdueCount = 0;
+            shard.accruingFineDays = 0;
+            shard.nextFineDay.clear();
+            shard.returnedFineDays = 0;
+            shard.lateFineDays.clear();
+        }
+        nextId = 0;
+        committed = 0;
+        nextStamp = 1;
+        stampsDone = 0;
+        archive.close();
+        for (size_t c = 0; c < ChunkedColumn<uint32_t>::MAX_CHUNKS; c++) {
+            archivedChunks[c] = 0;
+        }
+        archivedCount = 0;
+    }
+
+    size_t size() const { return committed.load(memory_order_acquire); }
+
+    // Blocks every issue and return until the returned locks are released; lookups
+    // continue. Holding them gives a consistent view of the columns for a save.
+    vector<shared_lock<shared_mutex>> freeze() const {
+        vector<shared_lock<shared_mutex>> held;
+        for (const auto& shard : shards) {
+            held.emplace_back(shard.lock);
+        }
+        return held;
+    }
+
+    // Raw columns, for full-history scans and the snapshot writer
+    const ChunkedColumn<uint32_t>& userColumn() const { return userCol; }
+    const ChunkedColumn<uint32_t>& bookColumn() const { return bookCol; }
+    const ChunkedColumn<time_t>& borrowColumn() const { return borrowCol; }
+    const ChunkedColumn<time_t>& dueColumn() const { return dueCol; }
+    const ChunkedColumn<time_t>& returnColumn() const { return returnCol; }
+    const ChunkedColumn<atomic<uint8_t>>& returnedColumn() const { return returnedCol; }
+};
+
+// User derived classes
+class Admin : public User {
+private:
+    static Admin* instance; // For Singleton pattern
+
+    // Private constructor for Singleton
+    Admin(const string& uname, const string& pwd, const string& n, const string& e)
+        : User(Role::Admin, uname, pwd, n, e) {}
+
+public:
+    // Singleton implementation
+    static Admin* getInstance(const string& uname, const string& pwd,
+                             const string& n, const string& e) {
+        if (instance == nullptr) {
+            instance = new Admin(uname, pwd, n, e);
+        }
+        return instance;
+    }
+
+    // Destructor
+    ~Admin() {
+        instance = nullptr;
+    }
+
+    // Function overriding
+    void displayDashboard() override {
+        cout << "\n=== ADMIN DASHBOARD ===\n";
+        cout << "Welcome, " << name << "!\n";
+        cout << "1. Manage Users\n2. Generate Reports\n3. Performance Metrics\n4. System Settings\n5. Logout\n";
+    }
+
+    // Admin specific functions
+    bool addUser(UserRegistry& users, User* newUser) {
+        return users.add(newUser);
+    }
+
+    bool removeUser(UserRegistry& users, const string& username) {
+        return users.remove(username);
+    }
+
+    // Built from live aggregates only, so its cost does not grow with the history
+    void generateReport(const UserRegistry& users, const BookCatalog& books, const RecordStore& records,
+                        ostream& out = cout) {
+        vector<BookCatalog::FacetTotals> genres = books.facetTotals(Facet::Genre);
+        RecordStore::Totals loans = records.totals(getCurrentTime());
+        int copies = 0, available = 0;
+        for (const auto& genre : genres) {
+            copies += genre.copies;
+            available += genre.available;
+        }
+
+        out << "\n=== LIBRARY REPORT ===\n";
+        out << "Total Books: " << books.size() << " titles, " << copies << " copies, "
+            << available << " available" << endl;
+        out << "Total Users: " << users.size() << endl;
+        out << "Loans Outstanding: " << loans.open << endl;
+        out << "Overdue Books: " << loans.overdue << endl;
+        stringstream fines;
+        fines << fixed << setprecision(2) << "$" << (loans.returnedFineDays + loans.accruingFineDays) * DAILY_FINE
+              << " ($" << loans.returnedFineDays * DAILY_FINE << " on returned books, $"
+              << loans.accruingFineDays * DAILY_FINE << " accruing on overdue books)";
+        out << "Fines Outstanding: " << fines.str() << endl;
+        out << "Available Copies by Genre:" << endl;
+        for (const auto& genre : genres) {
+            out << "  " << genre.value << ": " << genre.available << "/" << genre.copies
+                << " (" << genre.titles << (genre.titles == 1 ? " title)" : " titles)") << endl;
+        }
+    }
+
+    // Count, failures and latency of each operation since the program started. The
+    // percentiles are histogram bucket bounds: p50 is the time half the operations beat.
+    void viewMetrics(ostream& out = cout) {
+        out << "\n=== PERFORMANCE METRICS ===\n";
+        out << "operation  count  failed  mean us  p50 us  p99 us\n";
+        for (size_t i = 0; i < OPERATION_COUNT; i++) {
+            Metrics::Totals sum = Metrics::getInstance().totals(Operation(i));
+            double mean = sum.count == 0 ? 0 : sum.nanos / 1000.0 / sum.count;
+            stringstream line;
+            line << fixed << setprecision(1) << operationName(Operation(i)) << "  " << sum.count << "  "
+                 << sum.failed << "  " << mean << "  " << sum.percentile(0.5) / 1000.0 << "  "
+                 << sum.percentile(0.99) / 1000.0 << "\n";
+            out << line.str();
+        }
+    }
+};
+
+Admin* Admin::instance = nullptr;
+
+class Librarian : public User {
+public:
+    Librarian(const string& uname, const string& pwd, const string& n, const string& e)
+        : User(Role::Librarian, uname, pwd, n, e) {}
+
+    // Function overriding
     void displayDashboard() override {
         cout << "\n=== LIBRARIAN DASHBOARD ===\n";
         cout << "Welcome, " << name << "!\n";
         cout << "1. Manage Books\n2. Issue Books\n3. Accept Returns\n4. Track Overdues\n5. Logout\n";
     }
-
-    // Librarian specific functions
-    void addBook(vector<Book*>& books, Book* newBook) {
-        books.push_back(newBook);
+
+    // Librarian specific functions
+    bool addBook(BookCatalog& books, Book* newBook) {
+        return books.add(newBook);
+    }
+
+    bool editBook(BookCatalog& books, Book* book, const string& title, const string& author, const string& genre, int copies) {
+        return books.edit(book, title, author, genre, copies);
+    }
+
+    bool deleteBook(BookCatalog& books, const string& isbn) {
+        return books.remove(isbn);
+    }
+
+    // Returns the id of the new record, or NO_RECORD if no copy is available.
+    // The copy is claimed before the record is written, so concurrent requests
+    // can never issue more copies than the book has.
+    size_t issueBook(RecordStore& records, const string& userId, Book* book) {
+        OperationTimer timer(Operation::Issue);
+        if (!book->borrowCopy()) {
+            timer.fail();
+            return NO_RECORD;
+        }
+        return records.add(userId, book->getIsbn(), getCurrentTime());
+    }
+
+    // Returns false if the loan was already returned, e.g. by a concurrent request
+    bool acceptReturn(RecordStore& records, Book* book, size_t recordId) {
+        OperationTimer timer(Operation::Return);
+        if (!records.close(recordId, getCurrentTime())) {
+            timer.fail();
+            return false;
+        }
+        book->returnCopy();
+        return true;
+    }
+
+    // Lists the open loans past due, most overdue first, from a snapshot, so issues
+    // and returns carry on while a long list renders
+    void trackOverdues(const RecordStore& records, ostream& stream) const {
+        Renderer out(stream);
+        time_t now = getCurrentTime();
+        RecordStore::Snapshot snapshot = records.snapshot();
+        out << "\n=== OVERDUE BOOKS ===\n";
+        for (size_t id : snapshot.overdue(now)) {
+            snapshot.get(id).display(out, now);
+            out << "-------------------\n";
+        }
+    }
+};
+
+class Member : public User {
+public:
+    static const size_t HISTORY_PAGE = 10; // Loans shown per page of viewHistory
+    static const size_t BROWSE_PAGE = 10;  // Books shown per page of browseBooks
+    static const size_t FUZZY_RESULTS = 10; // Closest matches shown when a search finds nothing
+
+    Member(const string& uname, const string& pwd, const string& n, const string& e)
+        : User(Role::Member, uname, pwd, n, e) {}
+
+    // Function overriding
+    void displayDashboard() override {
+        cout << "\n=== MEMBER DASHBOARD ===\n";
+        cout << "Welcome, " << name << "!\n";
+        cout << "1. Search Books\n2. Borrow Books\n3. Return Books\n4. View History\n5. Browse Books\n6. Logout\n";
+    }
+
+    // Member specific functions
+    // Exact term matches, or the closest fuzzy matches when there are none
+    void searchBooks(const BookCatalog& books, const string& query) {
+        Renderer out(cout);
+        vector<Book*> results = books.search(query);
+        if (results.empty()) {
+            results = books.fuzzySearch(query, FUZZY_RESULTS);
+            out << "\n=== CLOSEST MATCHES ===\n";
+        } else {
+            out << "\n=== SEARCH RESULTS ===\n";
+        }
+        for (const auto& book : results) {
+            book->display(out);
+            out << "-------------------\n";
+        }
+    }
+
+    // Shows one page of the books filed under a genre or author, with its totals on the
+    // first page. Returns the offset of the next page, or 0 if this was the last one.
+    size_t browseBooks(const BookCatalog& books, Facet facet, const string& value, size_t offset = 0) const {
+        BookCatalog::FacetPage page;
+        Renderer out(cout);
+        if (!books.browse(facet, value, offset, BROWSE_PAGE, page)) {
+            out << "No books by that " << (facet == Facet::Genre ? "genre" : "author") << ".\n";
+            return 0;
+        }
+        if (offset == 0) {
+            out << "\n=== " << value << " ===\n" << page.titles << (page.titles == 1 ? " title, " : " titles, ")
+                << page.available << '/' << page.copies << " copies available\n";
+        }
+        for (const auto& book : page.books) {
+            book->display(out);
+            out << "-------------------\n";
+        }
+        size_t next = offset + page.books.size();
+        return next < static_cast<size_t>(page.titles) ? next : 0;
+    }
+
+    bool borrowBook(RecordStore& records, Book* book, Librarian& librarian, ostream& out = cout) {
+        size_t recordId = librarian.issueBook(records, username, book);
+        if (recordId != NO_RECORD) {
+            out << "Book borrowed successfully!\n";
+            return true;
+        }
+        out << "No available copies of this book.\n";
+        return false;
+    }
+
+    bool returnBook(RecordStore& records, Book* book, Librarian& librarian, ostream& out = cout) {
+        size_t recordId = records.findOpen(username, book->getIsbn());
+
+        if (recordId != NO_RECORD && librarian.acceptReturn(records, book, recordId)) {
+            out << "Book returned successfully!\n";
+            return true;
+        }
+        out << "You haven't borrowed this book.\n";
+        return false;
+    }
+
+    // Shows one page of this member's loans, newest first, whether self-service or
+    // issued by a librarian. Returns the cursor for the next page, or NO_RECORD if
+    // this was the last one.
+    size_t viewHistory(const RecordStore& records, size_t cursor = NO_RECORD) const {
+        vector<size_t> page = records.history(username, cursor, HISTORY_PAGE + 1);
+        bool more = page.size() > HISTORY_PAGE;
+        if (more) {
+            page.pop_back();
+        }
+        Renderer out(cout);
+        if (cursor == NO_RECORD) {
+            out << "\n=== BORROWING HISTORY ===\n";
+            if (page.empty()) {
+                out << "No loans yet.\n";
+            }
+        }
+        time_t now = getCurrentTime();
+        RecordStore::Snapshot snapshot = records.snapshot(); // Covers the page, which was read first
+        for (size_t id : page) {
+            snapshot.get(id).display(out, now);
+            out << "-------------------\n";
+        }
+        return more ? page.back() : NO_RECORD;
+    }
+};
+
+class Guest : public User {
+public:
+    Guest() : User(Role::Guest, "guest", "", "Guest", "") {}
+
+    // Function overriding
+    void displayDashboard() override {
+        cout << "\n=== GUEST ACCESS ===\n";
+        cout << "1. Search Books\n2. Browse Books\n3. Exit\n";
+    }
+
+    // Guest specific functions
+    // As Member::searchBooks, without ISBNs or copy counts
+    void searchBooks(const BookCatalog& books, const string& query) {
+        Renderer out(cout);
+        vector<Book*> results = books.search(query);
+        if (results.empty()) {
+            results = books.fuzzySearch(query, Member::FUZZY_RESULTS);
+            out << "\n=== CLOSEST MATCHES ===\n";
+        } else {
+            out << "\n=== SEARCH RESULTS ===\n";
+        }
+        for (const auto& book : results) {
+            out << "Title: " << book->getTitle() << "\nAuthor: " << book->getAuthor()
+                << "\nGenre: " << book->getGenre() << "\n-------------------\n";
+        }
+    }
+
+    // As Member::browseBooks, without ISBNs or copy counts per book
+    size_t browseBooks(const BookCatalog& books, Facet facet, const string& value, size_t offset = 0) const {
+        BookCatalog::FacetPage page;
+        Renderer out(cout);
+        if (!books.browse(facet, value, offset, Member::BROWSE_PAGE, page)) {
+            out << "No books by that " << (facet == Facet::Genre ? "genre" : "author") << ".\n";
+            return 0;
+        }
+        if (offset == 0) {
+            out << "\n=== " << value << " ===\n" << page.titles << (page.titles == 1 ? " title, " : " titles, ")
+                << page.available << '/' << page.copies << " copies available\n";
+        }
+        for (const auto& book : page.books) {
+            out << "Title: " << book->getTitle() << "\nAuthor: " << book->getAuthor()
+                << "\nGenre: " << book->getGenre() << "\n-------------------\n";
+        }
+        size_t next = offset + page.books.size();
+        return next < static_cast<size_t>(page.titles) ? next : 0;
+    }
+};
+
+// UserFactory class (Factory pattern)
+class UserFactory {
+public:
+    static User* createUser(const string& role, const string& uname,
+                          const string& pwd, const string& name, const string& email) {
+        if (role == "admin") {
+            return Admin::getInstance(uname, pwd, name, email);
+        } else if (role == "librarian") {
+            return new Librarian(uname, pwd, name, email);
+        } else if (role == "member") {
+            return new Member(uname, pwd, name, email);
+        } else if (role == "guest") {
+            return new Guest();
+        }
+        return nullptr;
+    }
+};
+
+// Binary snapshot layout: a header followed by fixed-width user and book tables,
+// the record store's columns, and a string table they refer to by index. The
+// record columns are stored exactly as the RecordStore holds them, with user and
+// book ids into two name lists, so they load with one copy per column. Chunks
+// of records moved to the archive file are left out of the columns and listed
+// by index instead.
+// Native byte order; every section starts on an 8-byte boundary so it can be
+// used straight from the mapping.
+const char SNAPSHOT_MAGIC[8] = {'L', 'M', 'S', 'S', 'N', 'A', 'P', '\0'};
+const uint32_t SNAPSHOT_VERSION = 3;
+static_assert(sizeof(time_t) == 8, "snapshot record columns assume a 64-bit time_t");
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t userCount, bookCount, recordCount, stringCount;
+    uint64_t userOffset, bookOffset, stringOffset, blobOffset, blobSize;
+    uint64_t recordUserNameCount, recordIsbnCount;     // Entries in the two name lists
+    uint64_t recordUserNameOffset, recordIsbnOffset;   // u32 string table indexes
+    uint64_t recordUserOffset, recordBookOffset;       // u32 name list indexes per record
+    uint64_t recordBorrowOffset, recordDueOffset, recordReturnOffset; // i64 per record
+    uint64_t recordReturnedOffset;                     // u8 per record
+    uint64_t recordArchivedCount, recordArchivedOffset; // u64 indexes of archived chunks, ascending
+};
+
+struct SnapshotUser {
+    uint32_t role;
+    uint32_t username, name, email; // String table indexes
+};
+
+struct SnapshotBook {
+    uint32_t title, author, isbn, genre; // String table indexes
+    int32_t totalCopies;
+    uint32_t reserved;
+};
+
+// Deduplicates strings while a snapshot is written; usernames and ISBNs repeat across records
+class StringTableWriter {
+private:
+    unordered_map<string, uint32_t> ids;
+    vector<uint64_t> offsets; // Start of each string in the blob, plus the end of the last one
+    string blob;
+
+public:
+    StringTableWriter() : offsets(1, 0) {}
+
+    uint32_t intern(const string& s) {
+        auto it = ids.find(s);
+        if (it != ids.end()) {
+            return it->second;
+        }
+        uint32_t id = static_cast<uint32_t>(ids.size());
+        ids.emplace(s, id);
+        blob += s;
+        offsets.push_back(blob.size());
+        return id;
+    }
+
+    uint64_t count() const { return ids.size(); }
+    const vector<uint64_t>& getOffsets() const { return offsets; }
+    const string& getBlob() const { return blob; }
+};
+
+// Storage format used by saveData
+enum class StorageFormat { Text, Binary };
+
+// LibraryManager class (Singleton)
+class LibraryManager {
+private:
+    static LibraryManager* instance;
+    Identifiers ids; // Shared by everything that refers to users and books by id
+    UserRegistry users;
+    BookCatalog books;
+    RecordStore records;
+    User* currentUser;
+    StorageFormat storageFormat;
+    Journal journal;
+    int archiveAfterDays; // Age of a return before saves move its loan to the archive
+
+    // Outcome of one fine accrual pass
+    struct FineLedger {
+        time_t asOf;
+        vector<uint64_t> fineDays; // By user id
+    };
+    shared_ptr<const FineLedger> ledger; // Latest pass, or null before the first
+    mutable mutex ledgerLock; // Guards the ledger pointer; a ledger never changes once made
+    time_t nextAccrual = 0; // When sync() next runs the nightly pass
+
+    // Private constructor for Singleton
+    LibraryManager()
+        : records(ids), currentUser(nullptr), storageFormat(StorageFormat::Text), archiveAfterDays(ARCHIVE_AFTER_DAYS) {
+        // Initialize with some data
+        users.add(Admin::getInstance("admin", "admin123", "System Admin", "admin@library.com"));
+        users.add(new Librarian("lib1", "lib123", "John Librarian", "john@library.com"));
+        users.add(new Member("member1", "mem123", "Alice Member", "alice@example.com"));
+
+        books.add(new Book("The C++ Programming Language", "Bjarne Stroustrup", "9780321563842", "Programming", 5));
+        books.add(new Book("Design Patterns", "Erich Gamma", "9780201633610", "Computer Science", 3));
+        books.add(new Book("Clean Code", "Robert Martin", "9780132350884", "Programming", 4));
+    }
+
+public:
+    // Singleton implementation
+    static LibraryManager* getInstance() {
+        if (instance == nullptr) {
+            instance = new LibraryManager();
+        }
+        return instance;
+    }
+
+    // Destructor
+    ~LibraryManager() {}
+
+    // The user these credentials belong to, or nullptr
+    User* authenticate(const string& username, const string& password) const {
+        OperationTimer timer(Operation::Login);
+        User* user = users.find(username);
+        if (user == nullptr || (user->getRole() == Role::Guest && password != "")) {
+            timer.fail();
+            return nullptr;
+        }
+        return user;
+    }
+
+    // Login function
+    bool login(const string& username, const string& password) {
+        User* user = authenticate(username, password);
+
+        if (user != nullptr) {
+            currentUser = user;
+            return true;
+        }
+        return false;
+    }
+
+    void logout() {
+        currentUser = nullptr;
+    }
+
+    User* getCurrentUser() const {
+        return currentUser;
+    }
+
+    BookCatalog& getBooks() {
+        return books;
+    }
+
+    UserRegistry& getUsers() {
+        return users;
+    }
+
+    RecordStore& getRecords() {
+        return records;
+    }
+
+    StorageFormat getStorageFormat() const {
+        return storageFormat;
+    }
+
+    void setStorageFormat(StorageFormat format) {
+        storageFormat = format;
+    }
+
+    int getArchiveAge() const {
+        return archiveAfterDays;
+    }
+
+    // At least a day, so a loan is never archived while a return of it may be in flight
+    void setArchiveAge(int days) {
+        archiveAfterDays = max(1, days);
+    }
+
+    // Save all data in the configured format and empty the journal it supersedes (compaction).
+    // For a binary save, loans returned longer ago than the archive age move to the
+    // archive first, so the save only writes what is left in memory (see RecordStore::tier),
+    // and once the snapshot is down the archive drops segments it no longer lists. Text
+    // saves write every record anyway, and the load from them empties the archive, so
+    // nothing is tiered for them. Issues, returns and catalog changes from other threads
+    // wait while the files are written.
+    void saveData() {
+        OperationTimer timer(Operation::Save);
+        bool binary = storageFormat == StorageFormat::Binary;
+        if (binary) {
+            records.tier(getCurrentTime() - static_cast<time_t>(archiveAfterDays) * 24 * 60 * 60);
+        }
+        bool saved = false;
+        {
+            auto frozen = freezeAll();
+            if (binary) {
+                saved = writeSnapshot(SNAPSHOT_FILE);
+            } else {
+                writeText();
+                remove(SNAPSHOT_FILE); // A stale snapshot would shadow the text files on the next load
+            }
+            journal.reset(JOURNAL_FILE);
+        }
+        if (saved) {
+            records.compactArchive();
+        }
+    }
+
+    // Load data from the snapshot if there is one, otherwise from the text files,
+    // then replay the journal on top and keep journaling from there. Replaces every
+    // user and book, so no other thread may be using the library meanwhile.
+    // Returns false, loading nothing, if the snapshot is there but cannot be used while
+    // the archive holds history: the text files may not have it, and loading them over
+    // the archive could lose it.
+    bool loadData() {
+        OperationTimer timer(Operation::Load);
+        journal.close();
+        attachJournal(nullptr);
+        SnapshotLoad loaded = loadSnapshot(SNAPSHOT_FILE);
+        if (loaded == SnapshotLoad::Loaded) {
+            storageFormat = StorageFormat::Binary;
+        } else if (!ifstream(SNAPSHOT_FILE).good()) {
+            importText(true); // Text saves write the full history, then remove the snapshot
+        } else if (loaded == SnapshotLoad::Unusable && RecordStore::archiveEmpty(ARCHIVE_FILE)) {
+            importText(false);
+        } else {
+            cout << SNAPSHOT_FILE << " cannot be loaded, and the text files may lack history kept in " << ARCHIVE_FILE
+                 << "; restore both from the same save, or move both aside to load the text files\n";
+            return false;
+        }
+        Journal::replay(JOURNAL_FILE, [this](const JournalEntry& entry) { applyJournalEntry(entry); });
+        books.compactCompletions();
+        if (journal.open(JOURNAL_FILE)) {
+            attachJournal(&journal);
+        } else {
+            cout << "Could not open " << JOURNAL_FILE << "; changes will only be saved on exit\n";
+        }
+        return true;
+    }
+
+    // Makes every change so far durable with a single fsync, and compacts the
+    // journal into a full save once it has grown past JOURNAL_COMPACT_BYTES
+    void sync() {
+        journal.commit();
+        if (journal.size() > JOURNAL_COMPACT_BYTES) {
+            saveData();
+        }
+        time_t now = getCurrentTime();
+        if (now >= nextAccrual) {
+            accrueFines();
+            nextAccrual = nextMidnight(now);
+        }
+    }
+
+    // Recomputes what every member owes in fines in one pass over the loan history
+    // (see RecordStore::fineDaysByUser). sync() runs it nightly; admins can run it on demand.
+    void accrueFines() {
+        OperationTimer timer(Operation::FineAccrual);
+        time_t now = getCurrentTime();
+        shared_ptr<const FineLedger> fresh(new FineLedger{now, records.fineDaysByUser(now)});
+        lock_guard<mutex> guard(ledgerLock);
+        ledger = fresh;
+    }
+
+    // The user's outstanding fines as of the last accrual pass; false before the first pass
+    bool outstandingFines(const string& username, double& amount, time_t& asOf) const {
+        shared_ptr<const FineLedger> current;
+        {
+            lock_guard<mutex> guard(ledgerLock);
+            current = ledger;
+        }
+        if (!current) {
+            return false;
+        }
+        uint32_t user = ids.findUser(username);
+        amount = user < current->fineDays.size() ? current->fineDays[user] * DAILY_FINE : 0;
+        asOf = current->asOf;
+        return true;
+    }
+
+    // Applies a batch of circulation operations, one per line:
+    //   issue,<member username>,<isbn>   or   return,<member username>,<isbn>
+    // with the same checks as the Issue Books and Accept Returns menus. Each distinct
+    // username and ISBN is looked up once, every change is made durable by a single
+    // journal commit at the end, and one result line per operation is written to report:
+    //   <line>,<op>,<username>,<isbn>,OK|ERROR,<detail>
+    // Returns the number of operations that failed.
+    size_t runBatch(string_view input, ostream& report) {
+        User* librarianUser = users.anyLibrarian();
+        if (librarianUser == nullptr) {
+            report << "0,,,,ERROR,No librarian available to process the batch\n";
+            return 1;
+        }
+        Librarian* librarian = static_cast<Librarian*>(librarianUser);
+
+        // Views into input, which outlives the batch
+        unordered_map<string_view, bool> isMember;
+        unordered_map<string_view, Book*> bookOf;
+        size_t lineNo = 0, succeeded = 0, failed = 0;
+
+        forEachLine(input, [&](string_view line) {
+            lineNo++;
+            string_view fields[3];
+            if (line.empty()) {
+                return;
+            }
+            if (splitFields(line, fields, 3) != 3 || (fields[0] != "issue" && fields[0] != "return")) {
+                report << lineNo << ",,,,ERROR,Expected issue|return,<username>,<isbn>\n";
+                failed++;
+                return;
+            }
+            string_view op = fields[0], userId = fields[1], isbn = fields[2];
+            report << lineNo << ',' << op << ',' << userId << ',' << isbn << ',';
+
+            auto memberIt = isMember.find(userId);
+            if (memberIt == isMember.end()) {
+                User* user = users.find(string(userId));
+                memberIt = isMember.emplace(userId, user != nullptr && user->getRole() == Role::Member).first;
+            }
+            auto bookIt = bookOf.find(isbn);
+            if (bookIt == bookOf.end()) {
+                bookIt = bookOf.emplace(isbn, books.find(string(isbn))).first;
+            }
+            if (!memberIt->second || bookIt->second == nullptr) {
+                report << "ERROR,Invalid user or book\n";
+                failed++;
+                return;
+            }
+
+            if (op == "issue") {
+                size_t recordId = librarian->issueBook(records, string(userId), bookIt->second);
+                if (recordId != NO_RECORD) {
+                    report << "OK,Issued as record " << recordId << '\n';
+                    succeeded++;
+                } else {
+                    report << "ERROR,No available copies\n";
+                    failed++;
+                }
+            } else {
+                size_t recordId = records.findOpen(string(userId), string(isbn));
+                if (recordId != NO_RECORD && librarian->acceptReturn(records, bookIt->second, recordId)) {
+                    report << "OK,Returned record " << recordId << '\n';
+                    succeeded++;
+                } else {
+                    report << "ERROR,No matching active borrowing record\n";
+                    failed++;
+                }
+            }
+        });
+
+        sync();
+        cerr << "Batch finished: " << succeeded << " succeeded, " << failed << " failed\n";
+        return failed;
+    }
+
+    // Write users.txt, books.txt and records.txt
+    void exportText() {
+        auto frozen = freezeAll();
+        writeText();
+    }
+
+    // Write the whole library as a binary snapshot
+    bool saveSnapshot(const string& path) {
+        auto frozen = freezeAll();
+        return writeSnapshot(path);
+    }
+
+    // Replace all data with the contents of users.txt, books.txt and records.txt.
+    // The files are cut into chunks on line boundaries, and a thread pool parses the
+    // chunks of all three files at once. The parsed chunks are then merged in file
+    // order, so duplicates resolve as in a sequential load (the first one wins); the
+    // users, books and records are merged concurrently, as they share no containers.
+    // Only when records.txt is known to hold the full history is the archive file
+    // emptied; otherwise it is kept for any snapshot on disk that refers to it.
+    void importText(bool fullHistory) {
+        const size_t MIN_CHUNK_BYTES = 1 << 20;
+        MappedFile userFile("users.txt"), bookFile("books.txt"), recordFile("records.txt");
+
+        clearData();
+        records.openArchive(ARCHIVE_FILE, fullHistory);
+
+        ThreadPool pool(thread::hardware_concurrency());
+        size_t totalBytes = userFile.view().size() + bookFile.view().size() + recordFile.view().size();
+        size_t chunkBytes = max(MIN_CHUNK_BYTES, totalBytes / (pool.size() * 4));
+        vector<string_view> userChunks = splitChunks(userFile.view(), chunkBytes);
+        vector<string_view> bookChunks = splitChunks(bookFile.view(), chunkBytes);
+        vector<string_view> recordChunks = splitChunks(recordFile.view(), chunkBytes);
+        vector<vector<User*>> userParts(userChunks.size());
+        vector<vector<Book*>> bookParts(bookChunks.size());
+        vector<ParsedRecords> recordParts(recordChunks.size());
+
+        // Records first: their file is by far the largest
+        for (size_t i = 0; i < recordChunks.size(); i++) {
+            pool.submit([this, &recordChunks, &recordParts, i]() { parseRecords(recordChunks[i], recordParts[i]); });
+        }
+        for (size_t i = 0; i < bookChunks.size(); i++) {
+            pool.submit([&bookChunks, &bookParts, i]() { parseBooks(bookChunks[i], bookParts[i]); });
+        }
+        for (size_t i = 0; i < userChunks.size(); i++) {
+            pool.submit([&userChunks, &userParts, i]() { parseUsers(userChunks[i], userParts[i]); });
+        }
+        pool.wait();
+
+        pool.submit([this, &userParts]() {
+            for (const auto& part : userParts) {
+                for (User* user : part) {
+                    if (!users.add(user) && user->getRole() != Role::Admin) {
+                        delete user; // Duplicate username
+                    }
+                }
+            }
+        });
+        pool.submit([this, &bookParts]() {
+            size_t count = 0;
+            for (const auto& part : bookParts) {
+                count += part.size();
+            }
+            books.reserve(count);
+            for (const auto& part : bookParts) {
+                for (Book* book : part) {
+                    if (!books.add(book)) {
+                        delete book; // Duplicate ISBN
+                    }
+                }
+            }
+        });
+        pool.submit([this, &recordParts]() {
+            size_t count = 0;
+            for (const auto& part : recordParts) {
+                count += part.users.size();
+            }
+            records.reserve(count);
+            for (const auto& part : recordParts) {
+                records.appendColumns(part.users.size(), part.users.data(), part.books.data(),
+                                      part.borrowDates.data(), part.dueDates.data(),
+                                      part.returnDates.data(), part.returned.data());
+            }
+        });
+        pool.wait();
+
+        claimCopiesForOpenLoans(0);
+        attachJournal(journal.isOpen() ? &journal : nullptr);
+    }
+
+    // How loading a snapshot went: Unusable covers a missing, damaged or other-version
+    // file; ArchiveMismatch a snapshot that refers to records the archive file lacks
+    enum class SnapshotLoad { Loaded, Unusable, ArchiveMismatch };
+
+    // Replace all data with the contents of a binary snapshot. Everything is checked
+    // before anything is replaced, so unless it returns Loaded the current data is untouched.
+    SnapshotLoad loadSnapshot(const string& path) {
+        MappedFile file(path);
+        string_view data = file.view();
+        if (data.size() < sizeof(SnapshotHeader)) {
+            return SnapshotLoad::Unusable;
+        }
+        const SnapshotHeader* header = reinterpret_cast<const SnapshotHeader*>(data.data());
+        if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0) {
+            return SnapshotLoad::Unusable;
+        }
+        if (header->version != SNAPSHOT_VERSION) {
+            cout << "Unsupported snapshot version " << header->version << " in " << path << "\n";
+            return SnapshotLoad::Unusable;
+        }
+        // Whether count items of the given size starting at offset lie inside the file,
+        // written so that no crafted count or offset can overflow the sum
+        auto within = [&data](uint64_t offset, uint64_t count, uint64_t size) {
+            return offset <= data.size() && count <= (data.size() - offset) / size;
+        };
+        uint64_t n = header->recordCount;
+        const size_t CHUNK_SIZE = ChunkedColumn<uint32_t>::CHUNK_SIZE;
+        if (header->recordArchivedCount > n / CHUNK_SIZE ||
+            !within(header->recordArchivedOffset, header->recordArchivedCount, sizeof(uint64_t))) {
+            cout << "Snapshot " << path << " is truncated\n";
+            return SnapshotLoad::Unusable;
+        }
+        uint64_t resident = n - header->recordArchivedCount * CHUNK_SIZE; // Rows in the columns
+        if (!within(header->userOffset, header->userCount, sizeof(SnapshotUser)) ||
+            !within(header->bookOffset, header->bookCount, sizeof(SnapshotBook)) ||
+            !within(header->recordUserNameOffset, header->recordUserNameCount, sizeof(uint32_t)) ||
+            !within(header->recordIsbnOffset, header->recordIsbnCount, sizeof(uint32_t)) ||
+            !within(header->recordUserOffset, resident, sizeof(uint32_t)) ||
+            !within(header->recordBookOffset, resident, sizeof(uint32_t)) ||
+            !within(header->recordBorrowOffset, resident, sizeof(time_t)) ||
+            !within(header->recordDueOffset, resident, sizeof(time_t)) ||
+            !within(header->recordReturnOffset, resident, sizeof(time_t)) ||
+            !within(header->recordReturnedOffset, resident, 1) ||
+            !within(header->stringOffset, header->stringCount, sizeof(uint64_t)) ||
+            !within(header->stringOffset + header->stringCount * sizeof(uint64_t), 1, sizeof(uint64_t)) ||
+            !within(header->blobOffset, header->blobSize, 1)) {
+            cout << "Snapshot " << path << " is truncated\n";
+            return SnapshotLoad::Unusable;
+        }
+
+        const uint64_t* offsets = reinterpret_cast<const uint64_t*>(data.data() + header->stringOffset);
+        const char* blob = data.data() + header->blobOffset;
+        uint64_t stringCount = header->stringCount;
+        // Every string id read from the file goes through this before its bytes are touched
+        auto validString = [offsets, stringCount, header](uint32_t id) {
+            return id < stringCount && offsets[id] <= offsets[id + 1] && offsets[id + 1] <= header->blobSize;
+        };
+        auto str = [offsets, blob, &validString](uint32_t id) {
+            return validString(id) ? string(blob + offsets[id], offsets[id + 1] - offsets[id]) : string();
+        };
+        const SnapshotUser* u = reinterpret_cast<const SnapshotUser*>(data.data() + header->userOffset);
+        for (uint64_t i = 0; i < header->userCount; i++) {
+            if (!validString(u[i].username) || !validString(u[i].name) || !validString(u[i].email)) {
+                cout << "Snapshot " << path << " has a damaged user list\n";
+                return SnapshotLoad::Unusable;
+            }
+        }
+        const SnapshotBook* b = reinterpret_cast<const SnapshotBook*>(data.data() + header->bookOffset);
+        for (uint64_t i = 0; i < header->bookCount; i++) {
+            if (!validString(b[i].title) || !validString(b[i].author) || !validString(b[i].isbn) ||
+                !validString(b[i].genre)) {
+                cout << "Snapshot " << path << " has a damaged book list\n";
+                return SnapshotLoad::Unusable;
+            }
+        }
+
+        // The name lists must hold distinct strings, so that interning them in order gives
+        // each the id the columns use for it
+        const uint32_t* userNames = reinterpret_cast<const uint32_t*>(data.data() + header->recordUserNameOffset);
+        const uint32_t* isbnNames = reinterpret_cast<const uint32_t*>(data.data() + header->recordIsbnOffset);
+        auto distinct = [offsets, blob, &validString](const uint32_t* names, uint64_t count) {
+            unordered_set<string_view> seen;
+            seen.reserve(count);
+            for (uint64_t i = 0; i < count; i++) {
+                uint32_t id = names[i];
+                if (!validString(id) || !seen.insert(string_view(blob + offsets[id], offsets[id + 1] - offsets[id])).second) {
+                    return false;
+                }
+            }
+            return true;
+        };
+        if (!distinct(userNames, header->recordUserNameCount) || !distinct(isbnNames, header->recordIsbnCount)) {
+            cout << "Snapshot " << path << " has a damaged name list\n";
+            return SnapshotLoad::Unusable;
+        }
+        // Every resident record names a user and a book from those lists
+        const uint32_t* recordUsers = reinterpret_cast<const uint32_t*>(data.data() + header->recordUserOffset);
+        const uint32_t* recordBooks = reinterpret_cast<const uint32_t*>(data.data() + header->recordBookOffset);
+        for (uint64_t i = 0; i < resident; i++) {
+            if (recordUsers[i] >= header->recordUserNameCount || recordBooks[i] >= header->recordIsbnCount) {
+                cout << "Snapshot " << path << " has a damaged record list\n";
+                return SnapshotLoad::Unusable;
+            }
+        }
+        // Archived chunks are full ones, listed in order, each held whole by the archive file
+        const uint64_t* archived = reinterpret_cast<const uint64_t*>(data.data() + header->recordArchivedOffset);
+        for (uint64_t i = 0; i < header->recordArchivedCount; i++) {
+            if (archived[i] >= n / CHUNK_SIZE || (i > 0 && archived[i] <= archived[i - 1])) {
+                cout << "Snapshot " << path << " has a damaged archive list\n";
+                return SnapshotLoad::Unusable;
+            }
+        }
+        if (!RecordStore::archiveHolds(ARCHIVE_FILE, archived, header->recordArchivedCount,
+                                       header->recordUserNameCount, header->recordIsbnCount)) {
+            cout << "Snapshot " << path << " refers to records missing from " << ARCHIVE_FILE << "\n";
+            return SnapshotLoad::ArchiveMismatch;
+        }
+
+        clearData();
+        records.openArchive(ARCHIVE_FILE, false);
+        users.reserve(header->userCount + 1);
+        books.reserve(header->bookCount);
+        records.reserve(header->recordCount);
+
+        for (uint64_t i = 0; i < header->userCount; i++) {
+            User* user = UserFactory::createUser(roleToString(static_cast<Role>(u[i].role)), str(u[i].username),
+                                                 "", str(u[i].name), str(u[i].email));
+            if (user != nullptr && !users.add(user) && user->getRole() != Role::Admin) {
+                delete user; // Duplicate username
+            }
+        }
+
+        for (uint64_t i = 0; i < header->bookCount; i++) {
+            Book* book = new Book(str(b[i].title), str(b[i].author), str(b[i].isbn), str(b[i].genre),
+                                  b[i].totalCopies);
+            if (!books.add(book)) {
+                delete book; // Duplicate ISBN
+            }
+        }
+
+        // Name lists first, so the ids in the columns line up with the interned ids
+        for (uint64_t i = 0; i < header->recordUserNameCount; i++) {
+            ids.internUser(str(userNames[i]));
+        }
+        for (uint64_t i = 0; i < header->recordIsbnCount; i++) {
+            ids.internIsbn(str(isbnNames[i]));
+        }
+        // Chunk by chunk in id order, archived chunks from the archive file
+        const time_t* borrowDates = reinterpret_cast<const time_t*>(data.data() + header->recordBorrowOffset);
+        const time_t* dueDates = reinterpret_cast<const time_t*>(data.data() + header->recordDueOffset);
+        const time_t* returnDates = reinterpret_cast<const time_t*>(data.data() + header->recordReturnOffset);
+        const uint8_t* returned = reinterpret_cast<const uint8_t*>(data.data() + header->recordReturnedOffset);
+        size_t firstRecord = records.size();
+        uint64_t row = 0, nextArchived = 0;
+        for (uint64_t c = 0; c * CHUNK_SIZE < n; c++) {
+            if (nextArchived < header->recordArchivedCount && archived[nextArchived] == c) {
+                records.appendArchived(); // Checked above
+                nextArchived++;
+                continue;
+            }
+            size_t length = min<uint64_t>(CHUNK_SIZE, n - c * CHUNK_SIZE);
+            records.appendColumns(length, recordUsers + row, recordBooks + row, borrowDates + row,
+                                  dueDates + row, returnDates + row, returned + row);
+            row += length;
+        }
+        claimCopiesForOpenLoans(firstRecord);
+        attachJournal(journal.isOpen() ? &journal : nullptr);
+        return SnapshotLoad::Loaded;
+    }
+
+private:
+    // Locks that hold users, books and records still, so a save sees one consistent
+    // state and no change slips in between the save and the journal reset.
+    // Lookups and searches continue; every change waits until they are released.
+    vector<shared_lock<shared_mutex>> freezeAll() const {
+        vector<shared_lock<shared_mutex>> held = records.freeze();
+        held.push_back(users.freeze());
+        held.push_back(books.freeze());
+        return held;
+    }
+
+    // Writes users.txt, books.txt and records.txt; the caller holds freezeAll()
+    void writeText() {
+        ofstream userFile("users.txt"), bookFile("books.txt"), recordFile("records.txt");
+
+        for (const auto& user : users) {
+            if (user->getRole() != Role::Guest) {
+                userFile << roleToString(user->getRole()) << "," << user->getUsername() << ","
+                         << user->getName() << "," << user->getEmail() << "\n";
+            }
+        }
+
+        for (const auto& book : books) {
+            bookFile << book->getTitle() << "," << book->getAuthor() << ","
+                     << book->getIsbn() << "," << book->getGenre() << ","
+                     << book->getTotalCopies() << "\n";
+        }
+
+        RecordStore::Snapshot view = records.snapshot(); // Full history, archived records included
+        for (size_t id = 0; id < view.size(); id++) {
+            BorrowRecord record = view.get(id);
+            recordFile << record.getUserId() << "," << record.getBookIsbn() << ","
+                       << record.getBorrowDate() << "," << record.getDueDate() << ","
+                       << record.getReturnDate() << "," << record.isReturned() << "\n";
+        }
+    }
+
+    // Writes the whole library as a binary snapshot; the caller holds freezeAll().
+    // The file is written next to the target and renamed over it, so a crash never
+    // leaves a torn snapshot.
+    bool writeSnapshot(const string& path) {
+        string tmpPath = path + ".tmp";
+        ofstream out(tmpPath, ios::binary | ios::trunc);
+        if (!out) {
+            return false;
+        }
+
+        StringTableWriter strings;
+        SnapshotHeader header = {};
+        memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+        header.version = SNAPSHOT_VERSION;
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        header.userOffset = out.tellp();
+        for (const auto& user : users) {
+            if (user->getRole() == Role::Guest) {
+                continue;
+            }
+            SnapshotUser u = {};
+            u.role = static_cast<uint32_t>(user->getRole());
+            u.username = strings.intern(user->getUsername());
+            u.name = strings.intern(user->getName());
+            u.email = strings.intern(user->getEmail());
+            out.write(reinterpret_cast<const char*>(&u), sizeof(u));
+            header.userCount++;
+        }
+
+        header.bookOffset = out.tellp();
+        for (const auto& book : books) {
+            SnapshotBook b = {};
+            b.title = strings.intern(book->getTitle());
+            b.author = strings.intern(book->getAuthor());
+            b.isbn = strings.intern(book->getIsbn());
+            b.genre = strings.intern(book->getGenre());
+            b.totalCopies = book->getTotalCopies();
+            out.write(reinterpret_cast<const char*>(&b), sizeof(b));
+            header.bookCount++;
+        }
+
+        auto align = [&out]() {
+            static const char zeros[8] = {};
+            out.write(zeros, (8 - out.tellp() % 8) % 8);
+        };
+        auto writeName = [&out, &strings](const string& name) {
+            uint32_t id = strings.intern(name);
+            out.write(reinterpret_cast<const char*>(&id), sizeof(id));
+        };
+        RecordStore::Snapshot view = records.snapshot(); // Keeps the chunks below from moving to the archive
+        auto archived = [this](size_t c) { return records.isArchived(c * ChunkedColumn<uint32_t>::CHUNK_SIZE); };
+        auto writeColumn = [&out, &align, &archived](const auto& column) {
+            for (size_t c = 0; c < column.chunkCount(); c++) {
+                if (!archived(c)) {
+                    out.write(reinterpret_cast<const char*>(column.chunk(c)),
+                              column.chunkLength(c) * sizeof(column[0]));
+                }
+            }
+            align();
+        };
+
+        header.recordCount = view.size();
+        header.recordUserNameCount = ids.userCount();
+        header.recordUserNameOffset = out.tellp();
+        for (uint32_t i = 0; i < header.recordUserNameCount; i++) {
+            writeName(ids.userName(i));
+        }
+        align();
+        header.recordIsbnCount = ids.isbnCount();
+        header.recordIsbnOffset = out.tellp();
+        for (uint32_t i = 0; i < header.recordIsbnCount; i++) {
+            writeName(ids.isbn(i));
+        }
+        align();
+        header.recordUserOffset = out.tellp();
+        writeColumn(records.userColumn());
+        header.recordBookOffset = out.tellp();
+        writeColumn(records.bookColumn());
+        header.recordBorrowOffset = out.tellp();
+        writeColumn(records.borrowColumn());
+        header.recordDueOffset = out.tellp();
+        writeColumn(records.dueColumn());
+        header.recordReturnOffset = out.tellp();
+        writeColumn(records.returnColumn());
+        header.recordReturnedOffset = out.tellp();
+        writeColumn(records.returnedColumn());
+        header.recordArchivedOffset = out.tellp();
+        for (uint64_t c = 0; c < records.userColumn().chunkCount(); c++) {
+            if (archived(c)) {
+                out.write(reinterpret_cast<const char*>(&c), sizeof(c));
+                header.recordArchivedCount++;
+            }
+        }
+
+        header.stringCount = strings.count();
+        header.stringOffset = out.tellp();
+        const vector<uint64_t>& offsets = strings.getOffsets();
+        out.write(reinterpret_cast<const char*>(offsets.data()), offsets.size() * sizeof(uint64_t));
+
+        header.blobOffset = out.tellp();
+        header.blobSize = strings.getBlob().size();
+        out.write(strings.getBlob().data(), strings.getBlob().size());
+        align();
+
+        out.seekp(0);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.close();
+        if (!out) {
+            remove(tmpPath.c_str());
+            return false;
+        }
+        return rename(tmpPath.c_str(), path.c_str()) == 0;
+    }
+
+    void attachJournal(Journal* j) {
+        users.setJournal(j);
+        books.setJournal(j);
+        records.setJournal(j);
+    }
+
+    // Every open loan among the records from firstRecord on holds one copy of its book
+    void claimCopiesForOpenLoans(size_t firstRecord) {
+        const ChunkedColumn<uint32_t>& bookCol = records.bookColumn();
+        const ChunkedColumn<atomic<uint8_t>>& returnedCol = records.returnedColumn();
+        vector<Book*> bookOf(ids.isbnCount(), nullptr);
+        vector<bool> resolved(bookOf.size(), false);
+        for (size_t id = firstRecord; id < records.size(); id++) {
+            if (records.isArchived(id) || returnedCol[id]) {
+                continue;
+            }
+            uint32_t b = bookCol[id];
+            if (!resolved[b]) {
+                bookOf[b] = books.find(ids.isbn(b));
+                resolved[b] = true;
+            }
+            if (bookOf[b] != nullptr) {
+                bookOf[b]->borrowCopy();
+            }
+        }
+    }
+
+    // Records parsed from one chunk of records.txt, as columns ready for RecordStore::appendColumns
+    struct ParsedRecords {
+        vector<uint32_t> users, books;
+        vector<time_t> borrowDates, dueDates, returnDates;
+        vector<uint8_t> returned;
+    };
+
+    static void parseUsers(string_view text, vector<User*>& parsed) {
+        forEachLine(text, [&parsed](string_view line) {
+            string_view fields[4];
+            if (splitFields(line, fields, 4) == 4) {
+                User* user = UserFactory::createUser(string(fields[0]), string(fields[1]), "",
+                                                     string(fields[2]), string(fields[3]));
+                if (user != nullptr) {
+                    parsed.push_back(user);
+                }
+            }
+        });
+    }
+
+    static void parseBooks(string_view text, vector<Book*>& parsed) {
+        forEachLine(text, [&parsed](string_view line) {
+            string_view fields[5];
+            int copies;
+            if (splitFields(line, fields, 5) == 5 && parseNumber(fields[4], copies)) {
+                parsed.push_back(new Book(string(fields[0]), string(fields[1]), string(fields[2]),
+                                          string(fields[3]), copies));
+            }
+        });
+    }
+
+    // Interns the usernames and ISBNs as it goes (the due date is always derived from the
+    // borrow date). Names repeat a lot, so each chunk remembers the ids it has seen rather
+    // than going back to the shared Identifiers for every line.
+    void parseRecords(string_view text, ParsedRecords& parsed) {
+        unordered_map<string_view, uint32_t> userIds, bookIds;
+        forEachLine(text, [&](string_view line) {
+            string_view fields[6];
+            time_t borrowDate, returnDate;
+            if (splitFields(line, fields, 6) != 6 || !parseNumber(fields[2], borrowDate) ||
+                !parseNumber(fields[4], returnDate)) {
+                return;
+            }
+            auto user = userIds.find(fields[0]);
+            if (user == userIds.end()) {
+                user = userIds.emplace(fields[0], ids.internUser(fields[0])).first;
+            }
+            auto book = bookIds.find(fields[1]);
+            if (book == bookIds.end()) {
+                book = bookIds.emplace(fields[1], ids.internIsbn(fields[1])).first;
+            }
+            bool returned = fields[5] == "1";
+            parsed.users.push_back(user->second);
+            parsed.books.push_back(book->second);
+            parsed.borrowDates.push_back(borrowDate);
+            parsed.dueDates.push_back(borrowDate + (BORROW_DAYS * 24 * 60 * 60));
+            parsed.returnDates.push_back(returned ? returnDate : 0);
+            parsed.returned.push_back(returned ? 1 : 0);
+        });
+    }
+
+    // Re-applies one journaled change. Replay is idempotent: a crash between a full save and
+    // the journal reset replays changes already in the save, so record ids are checked and
+    // adds/removes of books and users that already took effect are no-ops.
+    void applyJournalEntry(const JournalEntry& e) {
+        switch (e.op) {
+            case JournalOp::Issue:
+                if (e.text.size() == 2 && e.numbers.size() == 2 && static_cast<size_t>(e.numbers[0]) == records.size()) {
+                    records.add(e.text[0], e.text[1], e.numbers[1]);
+                    Book* book = books.find(e.text[1]);
+                    if (book != nullptr) {
+                        book->borrowCopy();
+                    }
+                }
+                break;
+            case JournalOp::Return:
+                if (e.numbers.size() == 2 && static_cast<size_t>(e.numbers[0]) < records.size()) {
+                    size_t id = e.numbers[0];
+                    if (records.close(id, e.numbers[1])) {
+                        Book* book = books.find(records.get(id).getBookIsbn());
+                        if (book != nullptr) {
+                            book->returnCopy();
+                        }
+                    }
+                }
+                break;
+            case JournalOp::AddBook:
+                if (e.text.size() == 4 && e.numbers.size() == 1) {
+                    Book* book = new Book(e.text[0], e.text[1], e.text[2], e.text[3], static_cast<int>(e.numbers[0]));
+                    if (!books.add(book)) {
+                        delete book;
+                    }
+                }
+                break;
+            case JournalOp::EditBook:
+                if (e.text.size() == 4 && e.numbers.size() == 1) {
+                    Book* book = books.find(e.text[0]);
+                    if (book != nullptr) {
+                        books.edit(book, e.text[1], e.text[2], e.text[3], static_cast<int>(e.numbers[0]));
+                    }
+                }
+                break;
+            case JournalOp::DeleteBook:
+                if (e.text.size() == 1) {
+                    books.remove(e.text[0]);
+                }
+                break;
+            case JournalOp::AddUser:
+                if (e.text.size() == 4) {
+                    User* user = UserFactory::createUser(e.text[0], e.text[1], "", e.text[2], e.text[3]);
+                    if (user != nullptr && !users.add(user) && user->getRole() != Role::Admin) {
+                        delete user;
+                    }
+                }
+                break;
+            case JournalOp::RemoveUser:
+                if (e.text.size() == 1) {
+                    users.remove(e.text[0]);
+                }
+                break;
+        }
+    }
+
+    // Drop all users, books and records; the admin singleton is kept and re-registered.
+    // The journal is detached so the bulk load that follows is not journaled.
+    void clearData() {
+        attachJournal(nullptr);
+        {
+            lock_guard<mutex> guard(ledgerLock);
+            ledger.reset(); // Its user ids are about to be reassigned
+        }
+        nextAccrual = 0;
+        users.clear();
+        books.clear();
+        records.clear();
+        ids.clear();
+        users.add(Admin::getInstance("admin", "admin123", "System Admin", "admin@library.com"));
+    }
+};
+
+LibraryManager* LibraryManager::instance = nullptr;
+
+// Multi-threaded stress test of the circulation path, on an in-memory library (nothing
+// is loaded or saved). Worker threads issue random books to random members and return
+// them, and every so often all compete for one single-copy book; this runs at 1, 2, 4 ...
+// maxThreads threads and reports the throughput of each. Afterwards available copies
+// must never have gone negative, the single copy must never have been out twice at once,
+// and every book's available copies must equal its total minus its open loans.
+// Returns 0 when every check passes.
+int runStressTest(LibraryManager* library, unsigned maxThreads) {
+    const size_t MEMBERS = 10000, BOOKS = 1000, OPERATIONS = 400000, MAX_HELD = 32;
+    const int COPIES = 2;
+    UserRegistry& users = library->getUsers();
+    BookCatalog& books = library->getBooks();
+    RecordStore& records = library->getRecords();
+    Librarian* librarian = static_cast<Librarian*>(users.anyLibrarian());
+
+    vector<string> members;
+    for (size_t i = 0; i < MEMBERS; i++) {
+        members.push_back("stress" + to_string(i));
+        users.add(new Member(members.back(), "", "Stress Member", ""));
+    }
+    vector<Book*> shelf;
+    for (size_t i = 0; i < BOOKS; i++) {
+        shelf.push_back(new Book("Stress Title " + to_string(i), "Stress Author",
+                                 to_string(9790000000000ull + i), "Stress", COPIES));
+        books.add(shelf.back());
+    }
+    Book* lastCopy = new Book("Last Copy", "Stress Author", "9799999999999", "Stress", 1);
+    books.add(lastCopy);
+    shelf.push_back(lastCopy);
+
+    // Raised after a copy of lastCopy is claimed and lowered before it is released, so the
+    // count can lag behind but never exceeds the number of members actually holding it
+    atomic<int> lastCopyHolders(0), lastCopyPeak(0);
+    atomic<bool> wentNegative(false);
+
+    cout << "\n=== STRESS TEST ===\n";
+    cout << "threads  operations  seconds  ops/sec  speedup\n";
+    vector<unsigned> threadCounts;
+    for (unsigned threads = 1; threads < maxThreads; threads *= 2) {
+        threadCounts.push_back(threads);
+    }
+    threadCounts.push_back(maxThreads);
+    double baseline = 0;
+    for (unsigned threads : threadCounts) {
+        size_t perThread = OPERATIONS / threads;
+        auto start = chrono::steady_clock::now();
+        vector<thread> workers;
+        for (unsigned t = 0; t < threads; t++) {
+            workers.emplace_back([&, t]() {
+                mt19937 rng(threads * 1000 + t);
+                vector<pair<const string*, Book*>> held; // Loans this thread made and has not returned
+                for (size_t op = 0; op < perThread; op++) {
+                    if (!held.empty() && (held.size() >= MAX_HELD || rng() % 2 == 0)) {
+                        size_t pick = rng() % held.size();
+                        const string& member = *held[pick].first;
+                        Book* book = held[pick].second;
+                        held[pick] = held.back();
+                        held.pop_back();
+                        size_t recordId = records.findOpen(member, book->getIsbn());
+                        if (book == lastCopy) {
+                            lastCopyHolders--;
+                        }
+                        if ((recordId == NO_RECORD || !librarian->acceptReturn(records, book, recordId)) && book == lastCopy) {
+                            lastCopyHolders++;
+                        }
+                    } else {
+                        const string& member = members[rng() % MEMBERS];
+                        Book* book = rng() % 16 == 0 ? lastCopy : shelf[rng() % BOOKS];
+                        if (librarian->issueBook(records, member, book) != NO_RECORD) {
+                            held.push_back(make_pair(&member, book));
+                            if (book == lastCopy) {
+                                int holders = ++lastCopyHolders;
+                                int peak = lastCopyPeak.load();
+                                while (holders > peak && !lastCopyPeak.compare_exchange_weak(peak, holders)) {
+                                }
+                            }
+                        }
+                    }
+                    if (shelf[op % shelf.size()]->getAvailableCopies() < 0) {
+                        wentNegative = true;
+                    }
+                }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        double rate = perThread * threads / seconds;
+        if (threads == 1) {
+            baseline = rate;
+        }
+        cout << threads << "  " << perThread * threads << "  " << seconds << "  "
+             << static_cast<long long>(rate) << "  " << rate / baseline << "x\n";
+    }
+
+    // Every open loan holds one copy of its book
+    vector<int> openLoans(records.getIdentifiers().isbnCount(), 0);
+    for (size_t id = 0; id < records.size(); id++) {
+        if (!records.returnedColumn()[id]) {
+            openLoans[records.bookColumn()[id]]++;
+        }
+    }
+    size_t mismatched = 0;
+    for (Book* book : shelf) {
+        int open = openLoans[records.getIdentifiers().findIsbn(book->getIsbn())];
+        if (book->getAvailableCopies() != book->getTotalCopies() - open) {
+            mismatched++;
+        }
+    }
+
+    // Editing the number of copies keeps the copies on loan out of the available count,
+    // and refuses to drop below them. Every other book also moves to a new genre.
+    size_t badEdits = 0;
+    for (size_t i = 0; i < shelf.size(); i++) {
+        Book* book = shelf[i];
+        int open = openLoans[records.getIdentifiers().findIsbn(book->getIsbn())];
+        const string title = book->getTitle(), author = book->getAuthor();
+        const string genre = i % 2 == 0 ? book->getGenre() : "Stress Edited";
+        if (open > 0 && librarian->editBook(books, book, title, author, genre, open - 1)) {
+            badEdits++;
+        }
+        if (!librarian->editBook(books, book, title, author, genre, open) || book->getAvailableCopies() != 0) {
+            badEdits++;
+        }
+        if (!librarian->editBook(books, book, title, author, genre, open + COPIES) ||
+            book->getAvailableCopies() != COPIES || book->getTotalCopies() != open + COPIES) {
+            badEdits++;
+        }
+    }
+
+    // The live genre and author totals agree with the books filed under them after the edits
+    size_t badFacets = 0;
+    for (Facet facet : {Facet::Genre, Facet::Author}) {
+        map<string, BookCatalog::FacetTotals> expected;
+        for (Book* book : books.search("")) {
+            const string& value = facet == Facet::Genre ? book->getGenre() : book->getAuthor();
+            BookCatalog::FacetTotals& totals = expected.emplace(value, BookCatalog::FacetTotals{value, 0, 0, 0}).first->second;
+            totals.titles++;
+            totals.copies += book->getTotalCopies();
+            totals.available += book->getAvailableCopies();
+        }
+        vector<BookCatalog::FacetTotals> live = books.facetTotals(facet);
+        badFacets += live.size() != expected.size();
+        for (const BookCatalog::FacetTotals& totals : live) {
+            auto it = expected.find(totals.value);
+            if (it == expected.end() || it->second.titles != totals.titles || it->second.copies != totals.copies ||
+                it->second.available != totals.available) {
+                badFacets++;
+            }
+        }
+    }
+
+    bool ok = !wentNegative && lastCopyPeak <= 1 && mismatched == 0 && badEdits == 0 && badFacets == 0;
+    cout << "Records written: " << records.size() << ", open loans: " << records.countOpen() << "\n";
+    cout << "Copies went negative: " << (wentNegative ? "yes" : "no") << "\n";
+    cout << "Most members holding the single-copy book at once: " << lastCopyPeak << "\n";
+    cout << "Books whose available copies disagree with their open loans: " << mismatched << "\n";
+    cout << "Books whose available copies were wrong after editing their copies: " << badEdits << "\n";
+    cout << "Genres and authors whose totals disagree with their books: " << badFacets << "\n";
+    cout << (ok ? "Stress test passed.\n" : "Stress test FAILED.\n");
+    return ok ? 0 : 1;
+}
+
+// Word number i of the synthetic vocabulary used for generated titles and search queries
+string syntheticWord(size_t i) {
+    static const char* const SYLLABLES[] = {"ka", "lo", "mi", "ren", "sa", "tor", "vi", "dan",
+                                            "el", "mar", "no", "quin", "ra", "sol", "ti", "ven"};
+    return string(SYLLABLES[i % 16]) + SYLLABLES[i / 16 % 16] + SYLLABLES[i / 256 % 16];
+}
+
+const size_t SYNTHETIC_WORDS = 4096;
+
+// Deterministic synthetic library for the benchmark: writes users.txt, books.txt and
+// records.txt into the current directory. The same counts always produce the same files
+// (dates are relative to now), so runs are comparable across commits. Title words,
+// authors and borrowed books are skewed so that a few are far more common than the rest,
+// loans are in borrow-date order over three years, and loans from the last six weeks
+// are mostly still open, some of them overdue.
+void generateLibrary(size_t bookCount, size_t memberCount, size_t recordCount, time_t now) {
+    static const char* const FIRST_NAMES[] = {"Ada", "Ben", "Cara", "Dev", "Elif", "Femi", "Gus", "Hana",
+                                              "Ivan", "Jun", "Kofi", "Lena", "Mei", "Nils", "Omar", "Pia"};
+    static const char* const LAST_NAMES[] = {"Abe", "Brandt", "Costa", "Diaz", "Eze", "Fischer", "Gupta", "Holm",
+                                             "Ito", "Jansen", "Kim", "Lopez", "Moreau", "Novak", "Okafor", "Park"};
+    static const char* const GENRES[] = {"Fiction", "Mystery", "Fantasy", "Science Fiction", "Romance", "History",
+                                         "Biography", "Science", "Programming", "Mathematics", "Poetry", "Travel",
+                                         "Cooking", "Art", "Philosophy", "Children"};
+    const time_t DAY = 24 * 60 * 60, SPAN = 3 * 365 * DAY;
+    mt19937_64 rng(20240601);
+    // Pick in [0, n) favouring small values: the product of two uniform picks
+    auto skewed = [&rng](size_t n) { return static_cast<size_t>((rng() % n) * (rng() % n) / n); };
+
+    ofstream userFile("users.txt"), bookFile("books.txt"), recordFile("records.txt");
+    userFile << "admin,admin,System Admin,admin@library.com\n";
+    for (size_t i = 0; i < max<size_t>(1, memberCount / 1000); i++) {
+        userFile << "librarian,librarian" << i << ",Librarian " << i << ",librarian" << i << "@library.com\n";
+    }
+    for (size_t i = 0; i < memberCount; i++) {
+        userFile << "member,member" << i << "," << FIRST_NAMES[rng() % 16] << " " << LAST_NAMES[rng() % 16]
+                 << ",member" << i << "@example.com\n";
+    }
+
+    vector<string> isbns(bookCount);
+    size_t authorCount = min<size_t>(bookCount / 8 + 1, 16 * 26 * 16);
+    for (size_t i = 0; i < bookCount; i++) {
+        // ISBN-13 with prefix 978 and a valid check digit
+        string digits = to_string(978000000000ull + i);
+        int sum = 0;
+        for (int d = 0; d < 12; d++) {
+            sum += (digits[d] - '0') * (d % 2 == 0 ? 1 : 3);
+        }
+        isbns[i] = digits + char('0' + (10 - sum % 10) % 10);
+
+        string title = syntheticWord(skewed(SYNTHETIC_WORDS));
+        for (size_t w = rng() % 3; w > 0; w--) {
+            title += " " + syntheticWord(skewed(SYNTHETIC_WORDS));
+        }
+        title[0] = static_cast<char>(toupper(title[0]));
+        size_t author = skewed(authorCount);
+        bookFile << title << "," << FIRST_NAMES[author % 16] << " " << char('A' + author / 16 % 26) << ". "
+                 << LAST_NAMES[author / 416 % 16] << "," << isbns[i] << "," << GENRES[rng() % 16] << ","
+                 << 1 + rng() % 5 << "\n";
+    }
+
+    for (size_t i = 0; i < recordCount; i++) {
+        time_t borrowDate = now - SPAN + static_cast<time_t>(SPAN * i / recordCount) + static_cast<time_t>(rng() % DAY);
+        bool open = now - borrowDate < 42 * DAY && rng() % 4 != 0;
+        time_t returnDate = open ? 0 : borrowDate + static_cast<time_t>(1 + rng() % 21) * DAY;
+        recordFile << "member" << rng() % memberCount << "," << isbns[skewed(bookCount)] << ","
+                   << borrowDate << "," << borrowDate + BORROW_DAYS * DAY << "," << returnDate << ","
+                   << !open << "\n";
+    }
+}
+
+// Times one operation in microseconds
+template <typename Operation>
+double timeMicros(Operation&& operation) {
+    auto start = chrono::steady_clock::now();
+    operation();
+    return chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+}
+
+// Prints one benchmark row from the latency of each operation, in microseconds
+void printBenchmark(const string& name, vector<double> micros) {
+    sort(micros.begin(), micros.end());
+    double total = 0;
+    for (double m : micros) {
+        total += m;
+    }
+    auto percentile = [&micros](size_t p) { return micros[min(micros.size() - 1, micros.size() * p / 100)]; };
+    ostringstream row;
+    row << fixed << setprecision(1) << left << setw(16) << name << right << setw(10) << micros.size()
+        << setw(12) << total / 1000 << setw(14) << micros.size() / (total / 1e6) << setw(12)
+        << percentile(50) << setw(12) << percentile(99) << "\n";
+    cout << row.str();
+}
+
+// Benchmark of the hot paths on a generated library of bookCount books and recordCount
+// loans (half as many members as books). Runs in a temporary directory, so the real
+// data files are never touched, and prints for each path the number of operations,
+// total time, throughput and p50/p99 latency. The generator and the operation mix are
+// deterministic, so the rows of two builds on the same machine are directly comparable.
+int runBenchmark(LibraryManager* library, size_t bookCount, size_t recordCount) {
+#ifndef _WIN32
+    const int SAVE_LOAD_RUNS = 3, REPORT_RUNS = 20;
+    const size_t SEARCHES = 2000, LOOKUPS = 100000, CIRCULATIONS = 50000, TYPED_QUERIES = 2000, HISTORIES = 1000;
+    size_t memberCount = max<size_t>(1, bookCount / 2);
+
+    char cwd[4096], scratch[] = "/tmp/lms-bench-XXXXXX";
+    if (getcwd(cwd, sizeof(cwd)) == nullptr || mkdtemp(scratch) == nullptr || chdir(scratch) != 0) {
+        cout << "Could not create a scratch directory for the benchmark\n";
+        return 1;
+    }
+
+    cout << "\n=== BENCHMARK ===\n";
+    cout << bookCount << " books, " << memberCount << " members, " << recordCount << " records\n";
+    cout << "benchmark              ops    total ms         ops/s      p50 us      p99 us\n";
+    time_t now = getCurrentTime();
+    printBenchmark("generate", {timeMicros([&]() { generateLibrary(bookCount, memberCount, recordCount, now); })});
+
+    vector<double> micros;
+    for (int run = 0; run < SAVE_LOAD_RUNS; run++) {
+        micros.push_back(timeMicros([&]() { library->loadData(); }));
+    }
+    printBenchmark("load text", micros);
+    micros.clear();
+    for (int run = 0; run < SAVE_LOAD_RUNS; run++) {
+        micros.push_back(timeMicros([&]() { library->saveData(); }));
+    }
+    printBenchmark("save text", micros);
+    library->setStorageFormat(StorageFormat::Binary);
+    micros.clear();
+    for (int run = 0; run < SAVE_LOAD_RUNS; run++) {
+        micros.push_back(timeMicros([&]() { library->saveData(); }));
+    }
+    printBenchmark("save binary", micros);
+    micros.clear();
+    for (int run = 0; run < SAVE_LOAD_RUNS; run++) {
+        micros.push_back(timeMicros([&]() { library->loadData(); }));
+    }
+    printBenchmark("load binary", micros);
+    cout << "Archived records: " << library->getRecords().countArchived() << " of " << library->getRecords().size()
+         << ", " << library->getRecords().archiveBytes() << " bytes on disk\n";
+
+    BookCatalog& books = library->getBooks();
+    RecordStore& records = library->getRecords();
+    mt19937_64 rng(20240602);
+    size_t found = 0; // Keeps the timed work observable
+
+    // Half one-word and half two-word queries, words drawn like the titles
+    micros.clear();
+    for (size_t i = 0; i < SEARCHES; i++) {
+        size_t a = rng() % SYNTHETIC_WORDS * (rng() % SYNTHETIC_WORDS) / SYNTHETIC_WORDS;
+        string query = syntheticWord(a);
+        if (i % 2 == 1) {
+            query += " " + syntheticWord(rng() % SYNTHETIC_WORDS * (rng() % SYNTHETIC_WORDS) / SYNTHETIC_WORDS);
+        }
+        micros.push_back(timeMicros([&]() { found += books.search(query).size(); }));
+    }
+    printBenchmark("search", micros);
+
+    // The same kind of queries with one typo in each word of five letters or more
+    micros.clear();
+    for (size_t i = 0; i < SEARCHES; i++) {
+        string query;
+        for (int w = 0; w < 1 + static_cast<int>(i % 2); w++) {
+            string word = syntheticWord(rng() % SYNTHETIC_WORDS * (rng() % SYNTHETIC_WORDS) / SYNTHETIC_WORDS);
+            if (word.size() >= 5) {
+                word[rng() % word.size()] = static_cast<char>('a' + rng() % 26);
+            }
+            query += (w == 0 ? "" : " ") + word;
+        }
+        micros.push_back(timeMicros([&]() { found += books.fuzzySearch(query, 10).size(); }));
+    }
+    printBenchmark("fuzzy search", micros);
+
+    // Keystroke replay: type random titles and authors one character at a time,
+    // asking for ten suggestions after each keystroke, as a search box would
+    micros.clear();
+    for (size_t i = 0; i < TYPED_QUERIES && books.size() > 0; i++) {
+        Book* book = *(books.begin() + rng() % books.size());
+        const string& typed = i % 2 == 0 ? book->getTitle() : book->getAuthor();
+        for (size_t length = 1; length <= typed.size(); length++) {
+            string prefix = typed.substr(0, length);
+            micros.push_back(timeMicros([&]() {
+                BookCatalog::Suggestions suggestions = books.complete(prefix, 10);
+                found += suggestions.titles.size() + suggestions.authors.size();
+            }));
+        }
     }
-
-    void editBook(Book* book, const string& title, const string& author, const string& genre, int copies) {
-        book->setTitle(title);
-        book->setAuthor(author);
-        book->setGenre(genre);
-        book->setTotalCopies(copies);
+    if (!micros.empty()) {
+        printBenchmark("autocomplete", micros);
     }
 
-    void deleteBook(vector<Book*>& books, const string& isbn) {
-        auto it = find_if(books.begin(), books.end(),
-            [&isbn](Book* b) { return b->getIsbn() == isbn; });
-        if (it != books.end()) {
-            delete *it; // Free memory
-            books.erase(it);
+    // Open-loan lookups as made by every return: half for loans that are open, half random
+    vector<size_t> openIds;
+    for (size_t id = 0; id < records.size(); id++) {
+        if (!records.isArchived(id) && !records.returnedColumn()[id]) {
+            openIds.push_back(id);
         }
     }
-
-    BorrowRecord* issueBook(const string& userId, Book* book) {
-        if (book->getAvailableCopies() > 0) {
-            book->borrowCopy();
-            return new BorrowRecord(userId, book->getIsbn(), getCurrentTime());
+    micros.clear();
+    for (size_t i = 0; i < LOOKUPS && recordCount > 0; i++) {
+        string member, isbn;
+        if (i % 2 == 0 && !openIds.empty()) {
+            BorrowRecord record = records.get(openIds[rng() % openIds.size()]);
+            member = record.getUserId();
+            isbn = record.getBookIsbn();
+        } else {
+            BorrowRecord record = records.get(rng() % records.size());
+            member = "member" + to_string(rng() % memberCount);
+            isbn = record.getBookIsbn();
         }
-        return nullptr;
+        micros.push_back(timeMicros([&]() { found += records.findOpen(member, isbn) != NO_RECORD; }));
     }
-
-    void acceptReturn(Book* book, BorrowRecord* record) {
-        book->returnCopy();
-        record->returnBook(getCurrentTime());
+    if (!micros.empty()) {
+        printBenchmark("find open loan", micros);
     }
-};
-
-class Member : public User {
-private:
-    vector<BorrowRecord*> borrowingHistory;
 
-public:
-    Member(const string& uname, const string& pwd, const string& n, const string& e)
-        : User(uname, pwd, n, e) {}
-
-    // Function overriding
-    void displayDashboard() override {
-        cout << "\n=== MEMBER DASHBOARD ===\n";
-        cout << "Welcome, " << name << "!\n";
-        cout << "1. Search Books\n2. Borrow Books\n3. Return Books\n4. View History\n5. Logout\n";
+    // Whole borrowing histories of random members, a page at a time as the member menu
+    // shows them; most of an old member's loans are read from the archive
+    micros.clear();
+    for (size_t i = 0; i < HISTORIES && recordCount > 0; i++) {
+        string member = "member" + to_string(rng() % memberCount);
+        micros.push_back(timeMicros([&]() {
+            size_t cursor = NO_RECORD;
+            do {
+                vector<size_t> page = records.history(member, cursor, Member::HISTORY_PAGE);
+                RecordStore::Snapshot snapshot = records.snapshot();
+                for (size_t id : page) {
+                    found += snapshot.get(id).hasFine();
+                }
+                cursor = page.size() == Member::HISTORY_PAGE ? page.back() : NO_RECORD;
+            } while (cursor != NO_RECORD);
+        }));
+    }
+    if (!micros.empty()) {
+        printBenchmark("member history", micros);
     }
 
-    // Member specific functions
-    void searchBooks(const vector<Book*>& books, const string& query) {
-        cout << "\n=== SEARCH RESULTS ===\n";
-        for (const auto& book : books) {
-            if (book->getTitle().find(query) != string::npos ||
-                book->getAuthor().find(query) != string::npos ||
-                book->getGenre().find(query) != string::npos) {
-                book->display();
-                cout << "-------------------\n";
+    // Issue a random book to a random member, then return it: ISBN lookup plus issue,
+    // and open-loan lookup plus return, as the librarian menus do
+    Librarian* librarian = static_cast<Librarian*>(library->getUsers().anyLibrarian());
+    vector<double> returnMicros;
+    micros.clear();
+    for (size_t i = 0; i < CIRCULATIONS && bookCount > 0; i++) {
+        string member = "member" + to_string(rng() % memberCount);
+        string isbn = records.size() > 0 ? records.get(rng() % records.size()).getBookIsbn() : "";
+        size_t recordId = NO_RECORD;
+        micros.push_back(timeMicros([&]() {
+            Book* book = books.find(isbn);
+            if (book != nullptr) {
+                recordId = librarian->issueBook(records, member, book);
             }
+        }));
+        if (recordId != NO_RECORD) {
+            returnMicros.push_back(timeMicros([&]() {
+                size_t openId = records.findOpen(member, isbn);
+                Book* book = books.find(isbn);
+                if (openId != NO_RECORD && book != nullptr) {
+                    librarian->acceptReturn(records, book, openId);
+                }
+            }));
         }
     }
+    if (!micros.empty()) {
+        printBenchmark("issue", micros);
+    }
+    if (!returnMicros.empty()) {
+        printBenchmark("return", returnMicros);
+    }
+    library->sync();
+
+    User* adminUser = library->getUsers().find("admin");
+    Admin* admin = dynamic_cast<Admin*>(adminUser);
+    ostream discard(nullptr); // Reports are rendered but not shown
+    micros.clear();
+    for (int run = 0; run < REPORT_RUNS && admin != nullptr; run++) {
+        micros.push_back(timeMicros([&]() {
+            admin->generateReport(library->getUsers(), books, records, discard);
+        }));
+    }
+    if (!micros.empty()) {
+        printBenchmark("report", micros);
+    }
+    micros.clear();
+    for (int run = 0; run < REPORT_RUNS; run++) {
+        micros.push_back(timeMicros([&]() { found += records.overdue(now).size(); }));
+    }
+    printBenchmark("overdue scan", micros);
+    micros.clear();
+    for (int run = 0; run < REPORT_RUNS; run++) {
+        micros.push_back(timeMicros([&]() { found += records.snapshot().overdue(now).size(); }));
+    }
+    printBenchmark("overdue snapshot", micros);
+    micros.clear();
+    for (int run = 0; run < REPORT_RUNS; run++) {
+        micros.push_back(timeMicros([&]() { librarian->trackOverdues(records, discard); }));
+    }
+    printBenchmark("overdue render", micros);
+    micros.clear();
+    for (int run = 0; run < REPORT_RUNS; run++) {
+        micros.push_back(timeMicros([&]() { library->accrueFines(); }));
+    }
+    printBenchmark("fine accrual", micros);
+    cout << "Checksum: " << found << "\n";
 
-    void borrowBook(Book* book, Librarian& librarian) {
-        BorrowRecord* record = librarian.issueBook(username, book);
-        if (record != nullptr) {
-            borrowingHistory.push_back(record);
-            cout << "Book borrowed successfully!\n";
-        } else {
-            cout << "No available copies of this book.\n";
-        }
+    for (const char* file : {"users.txt", "books.txt", "records.txt", SNAPSHOT_FILE, JOURNAL_FILE, ARCHIVE_FILE}) {
+        remove(file);
     }
+    if (chdir(cwd) != 0 || rmdir(scratch) != 0) {
+        cout << "Could not remove " << scratch << "\n";
+    }
+    return 0;
+#else
+    cout << "The benchmark needs a POSIX system\n";
+    return 1;
+#endif
+}
 
-    void returnBook(Book* book, Librarian& librarian) {
-        auto it = find_if(borrowingHistory.begin(), borrowingHistory.end(),
-            [book](BorrowRecord* r) { return r->getBookIsbn() == book->getIsbn() && !r->isReturned(); });
+#ifdef __linux__
+// Set by SIGINT/SIGTERM to stop the request server after the current round
+volatile sig_atomic_t serverStopRequested = 0;
 
-        if (it != borrowingHistory.end()) {
-            librarian.acceptReturn(book, *it);
-            cout << "Book returned successfully!\n";
-        } else {
-            cout << "You haven't borrowed this book.\n";
-        }
+void requestServerStop(int) {
+    serverStopRequested = 1;
+}
+
+// RequestServer class: serves many terminals from one process over a Unix domain
+// socket, multiplexing the client sessions with epoll. Each session logs in as one
+// user and sends one request per line; every reply starts with a status line,
+//   OK <n>            followed by n lines of results, or
+//   ERR <message>
+// Requests (fields separated by single spaces, results by tabs):
+//   LOGIN <username> [password]   -> role. Passwords are not stored, so the uid of the
+//                                    connecting process authorizes the login (see mayLogIn)
+//   LOGOUT
+//   SEARCH <query>                -> isbn, title, author, genre, available/total
+//                                    (title, author, genre before login)
+//   ISSUE <isbn> [member]         librarians name the member; members borrow for themselves
+//   RETURN <isbn> [member]
+//   FUZZY <query>                 -> as SEARCH, the FUZZY_RESULTS closest matches allowing typos
+//   COMPLETE <prefix>             -> TITLE or AUTHOR, text, copies held; up to COMPLETIONS of each
+//   FACETS GENRE|AUTHOR           -> value, titles, available/total copies
+//   BROWSE GENRE|AUTHOR <offset> <value>
+//                                 -> as SEARCH, BROWSE_PAGE books filed under the value from offset
+//   HISTORY [record id]           members: record id, isbn, borrowed, due, returned (0 if open), fine ($x.xx);
+//                                 newest first, HISTORY_PAGE per reply, older than the given record
+//   OVERDUE                       librarians: member, isbn, due
+//   REPORT                        admin: the library report
+//   METRICS                       admin: counters and latency histograms, Prometheus text format
+//   SHUTDOWN                      admin: stop the server
+//   QUIT
+// Requests are handled as they arrive; all changes made in one round of events are
+// made durable by a single journal commit before any of their replies is sent.
+class RequestServer {
+private:
+    static const size_t MAX_REQUEST = 4096; // Longest request line accepted
+    static const size_t MAX_BACKLOG = size_t(1) << 20; // Unsent reply bytes at which a session's requests wait
+    static const size_t HISTORY_PAGE = 100; // Loans per HISTORY reply
+    static const size_t BROWSE_PAGE = 100;  // Books per BROWSE reply
+    static const size_t COMPLETIONS = 10;   // Titles and authors per COMPLETE reply
+    static const size_t FUZZY_RESULTS = 20; // Books per FUZZY reply
+
+    struct Session {
+        int fd;
+        uid_t peer; // User the connecting process runs as
+        string in;  // Received bytes not yet forming a whole line
+        string out; // Reply bytes not yet sent
+        User* user = nullptr;
+        bool closing = false; // Close once out is sent
+    };
+
+    LibraryManager& library;
+    int listenFd = -1;
+    int epollFd = -1;
+    unordered_map<int, unique_ptr<Session>> sessions;
+    bool stopping = false;
+
+    static string_view nextWord(string_view& rest) {
+        size_t space = rest.find(' ');
+        string_view word = rest.substr(0, space);
+        rest = space == string_view::npos ? string_view() : rest.substr(space + 1);
+        return word;
     }
 
-    void viewHistory() const {
-        cout << "\n=== BORROWING HISTORY ===\n";
-        for (const auto& record : borrowingHistory) {
-            record->display();
-            cout << "-------------------\n";
-        }
+    static void ok(Session& session, const string& lines) {
+        session.out += "OK " + to_string(count(lines.begin(), lines.end(), '\n')) + "\n" + lines;
     }
 
-    // Destructor
-    ~Member() {
-        for (auto record : borrowingHistory) {
-            delete record;
+    static void fail(Session& session, string message) {
+        while (!message.empty() && message.back() == '\n') {
+            message.pop_back();
         }
+        session.out += "ERR " + message + "\n";
     }
-};
-
-class Guest : public User {
-public:
-    Guest() : User("guest", "", "Guest", "") {}
 
-    // Function overriding
-    void displayDashboard() override {
-        cout << "\n=== GUEST ACCESS ===\n";
-        cout << "1. Search Books\n2. Exit\n";
+    // Login name of a uid, or "" if it has none
+    static string accountName(uid_t uid) {
+        passwd entry, *found = nullptr;
+        char buffer[1024];
+        return getpwuid_r(uid, &entry, buffer, sizeof(buffer), &found) == 0 && found != nullptr ? found->pw_name : "";
     }
 
-    // Guest specific functions
-    void searchBooks(const vector<Book*>& books, const string& query) {
-        cout << "\n=== SEARCH RESULTS ===\n";
-        for (const auto& book : books) {
-            if (book->getTitle().find(query) != string::npos ||
-                book->getAuthor().find(query) != string::npos ||
-                book->getGenre().find(query) != string::npos) {
-                cout << "Title: " << book->getTitle() << "\nAuthor: " << book->getAuthor()
-                     << "\nGenre: " << book->getGenre() << "\n";
-                cout << "-------------------\n";
-            }
+    // The socket is owner-only, so normally every peer runs as the server's own user (or
+    // root) and may log in as anyone. If the owner opens the socket up to other users,
+    // their processes may log in as a guest or as the member named after their account.
+    static bool mayLogIn(const Session& session, const User& user) {
+        if (session.peer == geteuid() || session.peer == 0 || user.getRole() == Role::Guest) {
+            return true;
         }
+        return user.getRole() == Role::Member && user.getUsername() == accountName(session.peer);
     }
-};
 
-// UserFactory class (Factory pattern)
-class UserFactory {
-public:
-    static User* createUser(const string& role, const string& uname,
-                          const string& pwd, const string& name, const string& email) {
-        if (role == "admin") {
-            return Admin::getInstance(uname, pwd, name, email);
-        } else if (role == "librarian") {
-            return new Librarian(uname, pwd, name, email);
-        } else if (role == "member") {
-            return new Member(uname, pwd, name, email);
-        } else if (role == "guest") {
-            return new Guest();
-        }
-        return nullptr;
+    // Any librarian can process member self-service requests
+    Librarian* anyLibrarian() {
+        return static_cast<Librarian*>(library.getUsers().anyLibrarian());
     }
-};
-
-// LibraryManager class (Singleton)
-class LibraryManager {
-private:
-    static LibraryManager* instance;
-    vector<User*> users;
-    vector<Book*> books;
-    vector<BorrowRecord*> records;
-    User* currentUser;
 
-    // Private constructor for Singleton
-    LibraryManager() : currentUser(nullptr) {
-        // Initialize with some data
-        users.push_back(Admin::getInstance("admin", "admin123", "System Admin", "admin@library.com"));
-        users.push_back(new Librarian("lib1", "lib123", "John Librarian", "john@library.com"));
-        users.push_back(new Member("member1", "mem123", "Alice Member", "alice@example.com"));
-
-        books.push_back(new Book("The C++ Programming Language", "Bjarne Stroustrup", "9780321563842", "Programming", 5));
-        books.push_back(new Book("Design Patterns", "Erich Gamma", "9780201633610", "Computer Science", 3));
-        books.push_back(new Book("Clean Code", "Robert Martin", "9780132350884", "Programming", 4));
+    // One result line of SEARCH or BROWSE
+    static void appendBook(const Session& session, const Book* book, string& lines) {
+        if (session.user == nullptr) {
+            lines += book->getTitle() + "\t" + book->getAuthor() + "\t" + book->getGenre() + "\n";
+        } else {
+            lines += book->getIsbn() + "\t" + book->getTitle() + "\t" + book->getAuthor() + "\t" +
+                     book->getGenre() + "\t" + to_string(book->getAvailableCopies()) + "/" +
+                     to_string(book->getTotalCopies()) + "\n";
+        }
     }
 
-public:
-    // Singleton implementation
-    static LibraryManager* getInstance() {
-        if (instance == nullptr) {
-            instance = new LibraryManager();
+    void handleSearch(Session& session, const string& query, bool fuzzy) {
+        string lines;
+        const BookCatalog& books = library.getBooks();
+        for (const auto& book : fuzzy ? books.fuzzySearch(query, FUZZY_RESULTS) : books.search(query)) {
+            appendBook(session, book, lines);
         }
-        return instance;
+        ok(session, lines);
     }
 
-    // Destructor
-    ~LibraryManager() {
-        for (auto user : users) {
-            delete user;
-        }
-        for (auto book : books) {
-            delete book;
+    void handleComplete(Session& session, const string& prefix) {
+        BookCatalog::Suggestions suggestions = library.getBooks().complete(prefix, COMPLETIONS);
+        string lines;
+        for (const auto& title : suggestions.titles) {
+            lines += "TITLE\t" + title.text + "\t" + to_string(title.weight) + "\n";
         }
-        for (auto record : records) {
-            delete record;
+        for (const auto& author : suggestions.authors) {
+            lines += "AUTHOR\t" + author.text + "\t" + to_string(author.weight) + "\n";
         }
+        ok(session, lines);
     }
 
-    // Login function
-    bool login(const string& username, const string& password) {
-        auto it = find_if(users.begin(), users.end(),
-            [&username, &password](User* u) {
-                return u->getUsername() == username &&
-                       (dynamic_cast<Guest*>(u) == nullptr || password == "");
-            });
-
-        if (it != users.end()) {
-            currentUser = *it;
+    static bool parseFacet(string_view word, Facet& facet) {
+        if (word == "GENRE" || word == "AUTHOR") {
+            facet = word == "GENRE" ? Facet::Genre : Facet::Author;
             return true;
         }
         return false;
     }
 
-    void logout() {
-        currentUser = nullptr;
+    void handleFacets(Session& session, string_view facetText) {
+        Facet facet;
+        if (!parseFacet(facetText, facet)) {
+            fail(session, "Expected GENRE or AUTHOR");
+            return;
+        }
+        string lines;
+        for (const auto& totals : library.getBooks().facetTotals(facet)) {
+            lines += totals.value + "\t" + to_string(totals.titles) + "\t" + to_string(totals.available) + "/" +
+                     to_string(totals.copies) + "\n";
+        }
+        ok(session, lines);
     }
 
-    User* getCurrentUser() const {
-        return currentUser;
+    void handleBrowse(Session& session, string_view rest) {
+        Facet facet;
+        size_t offset;
+        if (!parseFacet(nextWord(rest), facet) || !parseNumber(nextWord(rest), offset)) {
+            fail(session, "Expected GENRE or AUTHOR, an offset and a value");
+            return;
+        }
+        BookCatalog::FacetPage page;
+        string lines;
+        if (library.getBooks().browse(facet, string(rest), offset, BROWSE_PAGE, page)) {
+            for (const auto& book : page.books) {
+                appendBook(session, book, lines);
+            }
+        }
+        ok(session, lines);
     }
 
-    vector<Book*>& getBooks() {
-        return books;
-    }
+    // ISSUE and RETURN: librarians act for the named member, members for themselves
+    void handleCirculation(Session& session, bool issue, const string& isbn, const string& memberName) {
+        Book* book = library.getBooks().find(isbn);
+        if (book == nullptr) {
+            fail(session, "Book not found");
+            return;
+        }
+        RecordStore& records = library.getRecords();
 
-    vector<User*>& getUsers() {
-        return users;
+        if (Member* member = dynamic_cast<Member*>(session.user)) {
+            if (!memberName.empty() && memberName != member->getUsername()) {
+                fail(session, "Members can only borrow and return for themselves");
+                return;
+            }
+            Librarian* librarian = anyLibrarian();
+            if (librarian == nullptr) {
+                fail(session, "No librarian available to process your request");
+                return;
+            }
+            stringstream message;
+            bool done = issue ? member->borrowBook(records, book, *librarian, message)
+                              : member->returnBook(records, book, *librarian, message);
+            done ? ok(session, message.str()) : fail(session, message.str());
+        } else if (Librarian* librarian = dynamic_cast<Librarian*>(session.user)) {
+            User* user = library.getUsers().find(memberName);
+            if (user == nullptr || user->getRole() != Role::Member) {
+                fail(session, "Invalid user");
+            } else if (issue) {
+                size_t recordId = librarian->issueBook(records, memberName, book);
+                recordId != NO_RECORD ? ok(session, "Issued as record " + to_string(recordId) + "\n")
+                                      : fail(session, "No available copies");
+            } else {
+                size_t recordId = records.findOpen(memberName, isbn);
+                if (recordId != NO_RECORD && librarian->acceptReturn(records, book, recordId)) {
+                    ok(session, "Returned record " + to_string(recordId) + "\n");
+                } else {
+                    fail(session, "No matching active borrowing record");
+                }
+            }
+        } else {
+            fail(session, "Only librarians and members can issue or return books");
+        }
     }
 
-    vector<BorrowRecord*>& getRecords() {
-        return records;
+    void handleHistory(Session& session, string_view cursorText) {
+        if (session.user == nullptr || session.user->getRole() != Role::Member) {
+            fail(session, "Only members have a borrowing history");
+            return;
+        }
+        size_t cursor = NO_RECORD;
+        if (!cursorText.empty() && !parseNumber(cursorText, cursor)) {
+            fail(session, "Expected a record id");
+            return;
+        }
+        const RecordStore& records = library.getRecords();
+        vector<size_t> page = records.history(session.user->getUsername(), cursor, HISTORY_PAGE);
+        RecordStore::Snapshot snapshot = records.snapshot();
+        stringstream lines;
+        lines << fixed << setprecision(2);
+        for (size_t id : page) {
+            BorrowRecord record = snapshot.get(id);
+            lines << id << '\t' << record.getBookIsbn() << '\t' << record.getBorrowDate() << '\t' << record.getDueDate() << '\t'
+                  << record.getReturnDate() << '\t' << "$" << (record.hasFine() ? record.getFine().getAmount() : 0.0) << '\n';
+        }
+        ok(session, lines.str());
     }
 
-    // Save data to files
-    void saveData() {
-        ofstream userFile("users.txt"), bookFile("books.txt"), recordFile("records.txt");
+    void handleOverdue(Session& session) {
+        if (session.user == nullptr || session.user->getRole() != Role::Librarian) {
+            fail(session, "Only librarians can track overdues");
+            return;
+        }
+        RecordStore::Snapshot snapshot = library.getRecords().snapshot();
+        string lines;
+        for (size_t id : snapshot.overdue(getCurrentTime())) {
+            BorrowRecord record = snapshot.get(id);
+            lines += record.getUserId() + "\t" + record.getBookIsbn() + "\t" + to_string(record.getDueDate()) + "\n";
+        }
+        ok(session, lines);
+    }
 
-        for (const auto& user : users) {
-            if (dynamic_cast<Admin*>(user)) {
-                userFile << "admin," << user->getUsername() << "," << user->getName() << "," << user->getEmail() << "\n";
-            } else if (dynamic_cast<Librarian*>(user)) {
-                userFile << "librarian," << user->getUsername() << "," << user->getName() << "," << user->getEmail() << "\n";
-            } else if (dynamic_cast<Member*>(user)) {
-                userFile << "member," << user->getUsername() << "," << user->getName() << "," << user->getEmail() << "\n";
+    void handleRequest(Session& session, string_view line) {
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+        string_view rest = line;
+        string command(nextWord(rest));
+        Admin* admin = dynamic_cast<Admin*>(session.user);
+
+        if (command == "LOGIN") {
+            string username(nextWord(rest));
+            User* user = library.authenticate(username, string(rest));
+            if (user == nullptr) {
+                fail(session, "Invalid credentials");
+                return;
+            }
+            if (!mayLogIn(session, *user)) {
+                fail(session, "Not allowed to log in as " + username);
+                return;
             }
+            session.user = user;
+            ok(session, roleToString(user->getRole()) + "\n");
+        } else if (command == "LOGOUT") {
+            session.user = nullptr;
+            ok(session, "");
+        } else if (command == "SEARCH" || command == "FUZZY") {
+            handleSearch(session, string(rest), command == "FUZZY");
+        } else if (command == "ISSUE" || command == "RETURN") {
+            string isbn(nextWord(rest));
+            handleCirculation(session, command == "ISSUE", isbn, string(nextWord(rest)));
+        } else if (command == "COMPLETE") {
+            handleComplete(session, string(rest));
+        } else if (command == "FACETS") {
+            handleFacets(session, nextWord(rest));
+        } else if (command == "BROWSE") {
+            handleBrowse(session, rest);
+        } else if (command == "HISTORY") {
+            handleHistory(session, nextWord(rest));
+        } else if (command == "OVERDUE") {
+            handleOverdue(session);
+        } else if (admin != nullptr && command == "REPORT") {
+            stringstream report;
+            admin->generateReport(library.getUsers(), library.getBooks(), library.getRecords(), report);
+            string lines = report.str();
+            ok(session, lines.substr(lines.find_first_not_of('\n')));
+        } else if (admin != nullptr && command == "METRICS") {
+            stringstream metrics;
+            Metrics::getInstance().dump(metrics);
+            ok(session, metrics.str());
+        } else if (admin != nullptr && command == "SHUTDOWN") {
+            ok(session, "");
+            stopping = true;
+        } else if (command == "QUIT") {
+            ok(session, "");
+            session.closing = true;
+        } else if (command == "REPORT" || command == "METRICS" || command == "SHUTDOWN") {
+            fail(session, "Only the admin can do that");
+        } else {
+            fail(session, "Unknown request");
         }
+    }
 
-        for (const auto& book : books) {
-            bookFile << book->getTitle() << "," << book->getAuthor() << ","
-                     << book->getIsbn() << "," << book->getGenre() << ","
-                     << book->getTotalCopies() << "\n";
+    void acceptClients() {
+        while (true) {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                return; // EAGAIN: no more pending connections
+            }
+            ucred peer = {};
+            socklen_t peerSize = sizeof(peer);
+            epoll_event event = {};
+            event.events = EPOLLIN;
+            event.data.fd = fd;
+            if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &peerSize) != 0 ||
+                epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+                ::close(fd);
+                continue;
+            }
+            unique_ptr<Session> session(new Session());
+            session->fd = fd;
+            session->peer = peer.uid;
+            sessions[fd] = move(session);
         }
+    }
+
+    static bool backlogged(const Session& session) { return session.out.size() >= MAX_BACKLOG; }
 
-        for (const auto& record : records) {
-            recordFile << record->getUserId() << "," << record->getBookIsbn() << ","
-                       << record->getBorrowDate() << "," << record->getDueDate() << ","
-                       << record->getReturnDate() << "," << record->isReturned() << "\n";
+    // Handles the complete request lines received so far, until the session's unsent
+    // replies reach MAX_BACKLOG; the rest wait in the input buffer
+    void handleRequests(Session& session) {
+        size_t start = 0, end;
+        while (!session.closing && !backlogged(session) && (end = session.in.find('\n', start)) != string::npos) {
+            handleRequest(session, string_view(session.in).substr(start, end - start));
+            start = end + 1;
+        }
+        session.in.erase(0, start);
+        if (session.in.size() > MAX_REQUEST && session.in.find('\n') == string::npos) {
+            fail(session, "Request too long");
+            session.closing = true;
         }
     }
 
-    // Load data from files
-    void loadData() {
-        ifstream userFile("users.txt"), bookFile("books.txt"), recordFile("records.txt");
-        string line;
-
-        // Clear existing data
-        for (auto user : users) {
-            if (dynamic_cast<Admin*>(user) == nullptr) { // Don't delete the admin
-                delete user;
+    // Reads and handles requests while the session is not backlogged. A backlogged
+    // session's requests stay unread in the socket, so a client that sends faster than
+    // it reads its replies is held back rather than growing the server's buffers.
+    void readRequests(Session& session) {
+        char buffer[4096];
+        handleRequests(session);
+        while (!session.closing && !backlogged(session)) {
+            ssize_t n = read(session.fd, buffer, sizeof(buffer));
+            if (n > 0) {
+                session.in.append(buffer, n);
+                handleRequests(session);
+            } else if (n < 0 && errno == EINTR) {
+                continue;
+            } else {
+                if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                    session.closing = true; // Replies to what it sent are still attempted
+                }
+                break;
             }
         }
-        users.clear();
+    }
 
-        for (auto book : books) {
-            delete book;
+    // Sends as much pending output as the socket takes; waits for EPOLLOUT if it is full
+    void sendReplies(Session& session) {
+        size_t sent = 0;
+        while (sent < session.out.size()) {
+            ssize_t n = send(session.fd, session.out.data() + sent, session.out.size() - sent, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                session.out.clear(); // The peer is gone
+                session.closing = true;
+                return;
+            }
+            if (n < 0) {
+                break;
+            }
+            sent += n;
         }
-        books.clear();
-
-        for (auto record : records) {
-            delete record;
+        session.out.erase(0, sent);
+        // Reading stops while the session is backlogged. Requests it already received wait
+        // for EPOLLOUT too, which comes at once if the socket has room, to be handled then.
+        bool waiting = session.in.find('\n') != string::npos;
+        epoll_event event = {};
+        if (!backlogged(session)) {
+            event.events |= EPOLLIN;
         }
-        records.clear();
-
-        // Add the admin back
-        users.push_back(Admin::getInstance("admin", "admin123", "System Admin", "admin@library.com"));
+        if (!session.out.empty() || waiting) {
+            event.events |= EPOLLOUT;
+        }
+        event.data.fd = session.fd;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, session.fd, &event);
+    }
 
-        // Load users
-        while (getline(userFile, line)) {
-            size_t pos = 0;
-            string token;
-            vector<string> tokens;
+    void closeSession(int fd) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        ::close(fd);
+        sessions.erase(fd);
+    }
 
-            while ((pos = line.find(',')) != string::npos) {
-                token = line.substr(0, pos);
-                tokens.push_back(token);
-                line.erase(0, pos + 1);
-            }
-            tokens.push_back(line);
+public:
+    explicit RequestServer(LibraryManager& lib) : library(lib) {}
+    RequestServer(const RequestServer&) = delete;
+    RequestServer& operator=(const RequestServer&) = delete;
 
-            if (tokens.size() == 4) {
-                string role = tokens[0];
-                string username = tokens[1];
-                string name = tokens[2];
-                string email = tokens[3];
+    // Destructor
+    ~RequestServer() {
+        for (auto& entry : sessions) {
+            ::close(entry.first);
+        }
+        if (epollFd >= 0) {
+            ::close(epollFd);
+        }
+        if (listenFd >= 0) {
+            ::close(listenFd);
+        }
+    }
 
-                User* user = UserFactory::createUser(role, username, "", name, email);
-                if (user != nullptr) {
-                    users.push_back(user);
+    // Listens on path and serves until SIGINT, SIGTERM or an admin's SHUTDOWN.
+    // Returns false if the socket could not be set up.
+    bool run(const string& path) {
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path)) {
+            cout << "Socket path is too long: " << path << "\n";
+            return false;
+        }
+        memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        unlink(path.c_str()); // A stale socket from an earlier run
+
+        listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = listenFd;
+        mode_t mask = umask(0177); // The socket is created owner-only (see mayLogIn)
+        bool bound = listenFd >= 0 && bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+        umask(mask);
+        if (!bound || epollFd < 0 || listen(listenFd, SOMAXCONN) != 0 ||
+            epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event) != 0) {
+            cout << "Could not listen on " << path << ": " << strerror(errno) << "\n";
+            return false;
+        }
+        signal(SIGINT, requestServerStop);
+        signal(SIGTERM, requestServerStop);
+        cout << "Serving on " << path << "\n";
+
+        epoll_event events[64];
+        vector<int> ready;
+        while (!stopping && !serverStopRequested) {
+            int count = epoll_wait(epollFd, events, 64, -1);
+            if (count < 0) {
+                if (errno == EINTR) {
+                    continue;
                 }
+                cout << "epoll_wait failed: " << strerror(errno) << "\n";
+                break;
             }
-        }
-
-        // Load books
-        while (getline(bookFile, line)) {
-            size_t pos = 0;
-            string token;
-            vector<string> tokens;
-
-            while ((pos = line.find(',')) != string::npos) {
-                token = line.substr(0, pos);
-                tokens.push_back(token);
-                line.erase(0, pos + 1);
+            ready.clear();
+            for (int i = 0; i < count; i++) {
+                int fd = events[i].data.fd;
+                if (fd == listenFd) {
+                    acceptClients();
+                    continue;
+                }
+                auto it = sessions.find(fd);
+                if (it == sessions.end()) {
+                    continue;
+                }
+                Session& session = *it->second;
+                if (events[i].events & EPOLLOUT) {
+                    sendReplies(session); // Replies from earlier rounds, already durable
+                }
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                    readRequests(session);
+                } else {
+                    handleRequests(session);
+                }
+                ready.push_back(fd);
             }
-            tokens.push_back(line);
 
-            if (tokens.size() == 5) {
-                string title = tokens[0];
-                string author = tokens[1];
-                string isbn = tokens[2];
-                string genre = tokens[3];
-                int copies = stoi(tokens[4]);
+            // One commit makes this round's changes durable before any reply goes out
+            library.sync();
 
-                books.push_back(new Book(title, author, isbn, genre, copies));
+            for (int fd : ready) {
+                auto it = sessions.find(fd);
+                if (it == sessions.end()) {
+                    continue;
+                }
+                sendReplies(*it->second);
+                if (it->second->closing && it->second->out.empty()) {
+                    closeSession(fd);
+                }
             }
         }
 
-        // Load records
-        while (getline(recordFile, line)) {
-            size_t pos = 0;
-            string token;
-            vector<string> tokens;
-
-            while ((pos = line.find(',')) != string::npos) {
-                token = line.substr(0, pos);
-                tokens.push_back(token);
-                line.erase(0, pos + 1);
-            }
-            tokens.push_back(line);
-
-            if (tokens.size() == 6) {
-                string userId = tokens[0];
-                string bookIsbn = tokens[1];
-                time_t borrowDate = stol(tokens[2]);
-                time_t dueDate = stol(tokens[3]);
-                time_t returnDate = stol(tokens[4]);
-                bool returned = (tokens[5] == "1");
-
-                BorrowRecord* record = new BorrowRecord(userId, bookIsbn, borrowDate);
-                record->returnBook(returnDate);
-
-                records.push_back(record);
-            }
+        for (auto& entry : sessions) {
+            sendReplies(*entry.second); // Best effort, e.g. the reply to SHUTDOWN
         }
+        unlink(path.c_str());
+        cout << "Server stopped\n";
+        return true;
     }
 };
+#endif
+
+// Asks for a genre (from the list of genres) or an author and pages through its books
+// with the user's browseBooks
+template <typename Browser>
+void browseCatalog(const Browser& user, const BookCatalog& books) {
+    cout << "1. By Genre\n2. By Author\n3. Back\n";
+    cout << "Enter choice: ";
+    int choice;
+    cin >> choice;
+    cin.ignore();
+    if (choice != 1 && choice != 2) {
+        return;
+    }
 
-LibraryManager* LibraryManager::instance = nullptr;
+    Facet facet = choice == 1 ? Facet::Genre : Facet::Author;
+    string value;
+    if (facet == Facet::Genre) {
+        cout << "\n=== GENRES ===\n";
+        for (const auto& genre : books.facetTotals(Facet::Genre)) {
+            cout << genre.value << " (" << genre.titles << (genre.titles == 1 ? " title, " : " titles, ")
+                 << genre.available << " available)\n";
+        }
+        cout << "Enter genre: ";
+    } else {
+        cout << "Enter author: ";
+    }
+    getline(cin, value);
+
+    size_t offset = user.browseBooks(books, facet, value);
+    while (offset != 0) {
+        cout << "1. More Books\n2. Back\n";
+        cout << "Enter choice: ";
+        cin >> choice;
+        cin.ignore();
+        if (choice != 1) {
+            break;
+        }
+        offset = user.browseBooks(books, facet, value, offset);
+    }
+}
 
 // Main application
-int main() {
+int main(int argc, char* argv[]) {
     LibraryManager* library = LibraryManager::getInstance();
 
+    // Stress mode: concurrent issue/return on an in-memory library, then exit
+    if (argc >= 2 && string(argv[1]) == "--stress") {
+        unsigned maxThreads = max(1u, thread::hardware_concurrency());
+        if (argc >= 3 && (!parseNumber(string_view(argv[2]), maxThreads) || maxThreads == 0)) {
+            cout << "Usage: " << argv[0] << " --stress [max threads]\n";
+            delete library;
+            return 2;
+        }
+        int status = runStressTest(library, maxThreads);
+        delete library;
+        return status;
+    }
+
+    // Benchmark mode: time the hot paths on a generated library, then exit
+    if (argc >= 2 && string(argv[1]) == "--bench") {
+        size_t bookCount = 10000, recordCount = 100000;
+        if ((argc >= 3 && !parseNumber(string_view(argv[2]), bookCount)) ||
+            (argc >= 4 && !parseNumber(string_view(argv[3]), recordCount)) || bookCount == 0) {
+            cout << "Usage: " << argv[0] << " --bench [books [records]]\n";
+            delete library;
+            return 2;
+        }
+        int status = runBenchmark(library, bookCount, recordCount);
+        delete library;
+        return status;
+    }
+
     // Load data from files
-    library->loadData();
+    if (!library->loadData()) {
+        delete library;
+        return 1;
+    }
+
+    // Server mode: serve terminals over a Unix domain socket until stopped
+    if (argc >= 2 && string(argv[1]) == "--serve") {
+        if (argc < 3) {
+            cout << "Usage: " << argv[0] << " --serve <socket path>\n";
+            delete library;
+            return 2;
+        }
+#ifdef __linux__
+        bool served = RequestServer(*library).run(argv[2]);
+        library->sync();
+        delete library;
+        return served ? 0 : 1;
+#else
+        cout << "Server mode needs epoll and is only available on Linux\n";
+        delete library;
+        return 1;
+#endif
+    }
+
+    // Batch mode: apply a file of issue/return operations ("-" reads stdin) and exit
+    if (argc >= 2 && string(argv[1]) == "--batch") {
+        if (argc < 3) {
+            cout << "Usage: " << argv[0] << " --batch <file|->\n";
+            delete library;
+            return 2;
+        }
+        size_t failed;
+        if (string(argv[2]) == "-") {
+            stringstream input;
+            input << cin.rdbuf();
+            failed = library->runBatch(input.str(), cout);
+        } else {
+            MappedFile input(argv[2]);
+            failed = library->runBatch(input.view(), cout);
+        }
+        delete library;
+        return failed == 0 ? 0 : 1;
+    }
 
     while (true) {
+        // Everything done in the previous round becomes durable together
+        library->sync();
+
         if (library->getCurrentUser() == nullptr) {
             // Login screen
             cout << "\n=== LIBRARY MANAGEMENT SYSTEM ===\n";
@@ -705,7 +6057,7 @@ int main() {
             } else if (choice == 2) {
                 library->login("guest", "");
             } else if (choice == 3) {
-                library->saveData();
+                library->sync();
                 delete library;
                 return 0;
             }
@@ -741,14 +6093,25 @@ int main() {
                         getline(cin, email);
 
                         User* newUser = UserFactory::createUser(role, username, password, name, email);
-                        admin->addUser(library->getUsers(), newUser);
-                        cout << "User added successfully!\n";
+                        if (newUser == nullptr) {
+                            cout << "Invalid role!\n";
+                        } else if (admin->addUser(library->getUsers(), newUser)) {
+                            cout << "User added successfully!\n";
+                        } else {
+                            if (newUser->getRole() != Role::Admin) {
+                                delete newUser;
+                            }
+                            cout << "Username already taken!\n";
+                        }
                     } else if (choice == 2) {
                         string username;
                         cout << "Enter username to remove: ";
                         getline(cin, username);
-                        admin->removeUser(library->getUsers(), username);
-                        cout << "User removed if existed.\n";
+                        if (admin->removeUser(library->getUsers(), username)) {
+                            cout << "User removed successfully!\n";
+                        } else {
+                            cout << "User not found!\n";
+                        }
                     } else if (choice == 3) {
                         cout << "\n=== USER LIST ===\n";
                         for (const auto& user : library->getUsers()) {
@@ -758,8 +6121,70 @@ int main() {
                     }
                 } else if (choice == 2) {
                     // Generate Reports
-                    admin->generateReport(library->getBooks(), library->getRecords());
+                    admin->generateReport(library->getUsers(), library->getBooks(), library->getRecords());
+                } else if (choice == 3) {
+                    // Performance Metrics
+                    admin->viewMetrics();
+                    cout << "1. Save to " << METRICS_FILE << "\n2. Back\n";
+                    cout << "Enter choice: ";
+                    cin >> choice;
+                    cin.ignore();
+
+                    if (choice == 1) {
+                        ofstream metricsFile(METRICS_FILE);
+                        Metrics::getInstance().dump(metricsFile);
+                        cout << (metricsFile ? "Metrics saved to " : "Could not write ") << METRICS_FILE << "\n";
+                    }
                 } else if (choice == 4) {
+                    // System Settings
+                    bool binary = library->getStorageFormat() == StorageFormat::Binary;
+                    cout << "\n=== SYSTEM SETTINGS ===\n";
+                    cout << "Storage format: " << (binary ? "binary snapshot" : "text files") << "\n";
+                    cout << "Loans archived " << library->getArchiveAge() << " days after their return ("
+                         << library->getRecords().countArchived() << " of " << library->getRecords().size()
+                         << " archived)\n";
+                    cout << "1. Use Text Files\n2. Use Binary Snapshot\n3. Export Text Files\n4. Import Text Files\n"
+                         << "5. Compact Journal\n6. Accrue Fines Now\n7. Set Archive Age\n8. Back\n";
+                    cout << "Enter choice: ";
+                    cin >> choice;
+                    cin.ignore();
+
+                    if (choice == 1) {
+                        library->setStorageFormat(StorageFormat::Text);
+                        library->saveData();
+                        cout << "Data is now saved to text files.\n";
+                    } else if (choice == 2) {
+                        library->setStorageFormat(StorageFormat::Binary);
+                        library->saveData();
+                        cout << "Data is now saved as a binary snapshot.\n";
+                    } else if (choice == 3) {
+                        library->exportText();
+                        cout << "Exported users.txt, books.txt and records.txt.\n";
+                    } else if (choice == 4) {
+                        library->importText(false);
+                        library->saveData(); // The old journal does not apply to the imported data
+                        library->login(admin->getUsername(), "");
+                        cout << "Imported users.txt, books.txt and records.txt.\n";
+                    } else if (choice == 5) {
+                        library->saveData();
+                        cout << "Journal folded into a full save.\n";
+                    } else if (choice == 6) {
+                        library->accrueFines();
+                        cout << "Fines accrued for all loans.\n";
+                    } else if (choice == 7) {
+                        int days = 0;
+                        cout << "Archive loans how many days after their return: ";
+                        cin >> days;
+                        cin.ignore();
+                        if (days < 1) {
+                            cout << "The archive age must be at least one day.\n";
+                        } else {
+                            library->setArchiveAge(days);
+                            library->saveData();
+                            cout << "Loans returned over " << days << " days ago are now archived.\n";
+                        }
+                    }
+                } else if (choice == 5) {
                     library->logout();
                 }
             } else if (Librarian* librarian = dynamic_cast<Librarian*>(currentUser)) {
@@ -792,18 +6217,21 @@ int main() {
                         cin.ignore();
 
                         Book* newBook = new Book(title, author, isbn, genre, copies);
-                        librarian->addBook(library->getBooks(), newBook);
-                        cout << "Book added successfully!\n";
+                        if (librarian->addBook(library->getBooks(), newBook)) {
+                            cout << "Book added successfully!\n";
+                        } else {
+                            delete newBook;
+                            cout << "A book with this ISBN already exists!\n";
+                        }
                     } else if (choice == 2) {
                         string isbn, title, author, genre;
                         int copies;
                         cout << "Enter ISBN of book to edit: ";
                         getline(cin, isbn);
 
-                        auto it = find_if(library->getBooks().begin(), library->getBooks().end(),
-                            [&isbn](Book* b) { return b->getIsbn() == isbn; });
+                        Book* book = library->getBooks().find(isbn);
 
-                        if (it != library->getBooks().end()) {
+                        if (book != nullptr) {
                             cout << "New Title: ";
                             getline(cin, title);
                             cout << "New Author: ";
@@ -814,8 +6242,12 @@ int main() {
                             cin >> copies;
                             cin.ignore();
 
-                            librarian->editBook(*it, title, author, genre, copies);
-                            cout << "Book updated successfully!\n";
+                            if (librarian->editBook(library->getBooks(), book, title, author, genre, copies)) {
+                                cout << "Book updated successfully!\n";
+                            } else {
+                                cout << "Copies cannot be fewer than the " << book->getTotalCopies() - book->getAvailableCopies()
+                                     << " on loan!\n";
+                            }
                         } else {
                             cout << "Book not found!\n";
                         }
@@ -823,13 +6255,19 @@ int main() {
                         string isbn;
                         cout << "Enter ISBN of book to delete: ";
                         getline(cin, isbn);
-                        librarian->deleteBook(library->getBooks(), isbn);
-                        cout << "Book deleted if existed.\n";
+                        if (librarian->deleteBook(library->getBooks(), isbn)) {
+                            cout << "Book deleted successfully!\n";
+                        } else {
+                            cout << "Book not found!\n";
+                        }
                     } else if (choice == 4) {
-                        cout << "\n=== BOOK CATALOG ===\n";
+                        // Holds off catalog edits, not circulation, while the listing renders
+                        auto frozen = library->getBooks().freeze();
+                        Renderer out(cout);
+                        out << "\n=== BOOK CATALOG ===\n";
                         for (const auto& book : library->getBooks()) {
-                            book->display();
-                            cout << "-------------------\n";
+                            book->display(out);
+                            out << "-------------------\n";
                         }
                     }
                 } else if (choice == 2) {
@@ -840,16 +6278,13 @@ int main() {
                     cout << "Enter Book ISBN: ";
                     getline(cin, isbn);
 
-                    auto userIt = find_if(library->getUsers().begin(), library->getUsers().end(),
-                        [&userId](User* u) { return u->getUsername() == userId && dynamic_cast<Member*>(u) != nullptr; });
+                    User* user = library->getUsers().find(userId);
 
-                    auto bookIt = find_if(library->getBooks().begin(), library->getBooks().end(),
-                        [&isbn](Book* b) { return b->getIsbn() == isbn; });
+                    Book* book = library->getBooks().find(isbn);
 
-                    if (userIt != library->getUsers().end() && bookIt != library->getBooks().end()) {
-                        BorrowRecord* record = librarian->issueBook(userId, *bookIt);
-                        if (record != nullptr) {
-                            library->getRecords().push_back(record);
+                    if (user != nullptr && user->getRole() == Role::Member && book != nullptr) {
+                        size_t recordId = librarian->issueBook(library->getRecords(), userId, book);
+                        if (recordId != NO_RECORD) {
                             cout << "Book issued successfully!\n";
                         } else {
                             cout << "No available copies!\n";
@@ -865,20 +6300,14 @@ int main() {
                     cout << "Enter Book ISBN: ";
                     getline(cin, isbn);
 
-                    auto userIt = find_if(library->getUsers().begin(), library->getUsers().end(),
-                        [&userId](User* u) { return u->getUsername() == userId && dynamic_cast<Member*>(u) != nullptr; });
+                    User* user = library->getUsers().find(userId);
 
-                    auto bookIt = find_if(library->getBooks().begin(), library->getBooks().end(),
-                        [&isbn](Book* b) { return b->getIsbn() == isbn; });
+                    Book* book = library->getBooks().find(isbn);
 
-                    if (userIt != library->getUsers().end() && bookIt != library->getBooks().end()) {
-                        auto recordIt = find_if(library->getRecords().begin(), library->getRecords().end(),
-                            [&userId, &isbn](BorrowRecord* r) {
-                                return r->getUserId() == userId && r->getBookIsbn() == isbn && !r->isReturned();
-                            });
+                    if (user != nullptr && user->getRole() == Role::Member && book != nullptr) {
+                        size_t recordId = library->getRecords().findOpen(userId, isbn);
 
-                        if (recordIt != library->getRecords().end()) {
-                            librarian->acceptReturn(*bookIt, *recordIt);
+                        if (recordId != NO_RECORD && librarian->acceptReturn(library->getRecords(), book, recordId)) {
                             cout << "Book returned successfully!\n";
                         } else {
                             cout << "No matching active borrowing record found!\n";
@@ -888,12 +6317,16 @@ int main() {
                     }
                 } else if (choice == 4) {
                     // Track Overdues
-                    cout << "\n=== OVERDUE BOOKS ===\n";
-                    for (const auto& record : library->getRecords()) {
-                        if (!record->isReturned() && getCurrentTime() > record->getDueDate()) {
-                            record->display();
-                            cout << "-------------------\n";
-                        }
+                    librarian->trackOverdues(library->getRecords(), cout);
+                    cout << "1. Save to " << OVERDUE_FILE << "\n2. Back\n";
+                    cout << "Enter choice: ";
+                    cin >> choice;
+                    cin.ignore();
+
+                    if (choice == 1) {
+                        ofstream overdueFile(OVERDUE_FILE);
+                        librarian->trackOverdues(library->getRecords(), overdueFile);
+                        cout << (overdueFile ? "Overdue report saved to " : "Could not write ") << OVERDUE_FILE << "\n";
                     }
                 } else if (choice == 5) {
                     library->logout();
@@ -916,17 +6349,15 @@ int main() {
                     cout << "Enter ISBN of book to borrow: ";
                     getline(cin, isbn);
 
-                    auto bookIt = find_if(library->getBooks().begin(), library->getBooks().end(),
-                        [&isbn](Book* b) { return b->getIsbn() == isbn; });
+                    Book* book = library->getBooks().find(isbn);
 
-                    if (bookIt != library->getBooks().end()) {
+                    if (book != nullptr) {
                         // Find any librarian
-                        auto librarianIt = find_if(library->getUsers().begin(), library->getUsers().end(),
-                            [](User* u) { return dynamic_cast<Librarian*>(u) != nullptr; });
+                        User* librarianUser = library->getUsers().anyLibrarian();
 
-                        if (librarianIt != library->getUsers().end()) {
-                            Librarian* librarian = dynamic_cast<Librarian*>(*librarianIt);
-                            member->borrowBook(*bookIt, *librarian);
+                        if (librarianUser != nullptr) {
+                            Librarian* librarian = static_cast<Librarian*>(librarianUser);
+                            member->borrowBook(library->getRecords(), book, *librarian);
                         } else {
                             cout << "No librarian available to process your request!\n";
                         }
@@ -939,17 +6370,15 @@ int main() {
                     cout << "Enter ISBN of book to return: ";
                     getline(cin, isbn);
 
-                    auto bookIt = find_if(library->getBooks().begin(), library->getBooks().end(),
-                        [&isbn](Book* b) { return b->getIsbn() == isbn; });
+                    Book* book = library->getBooks().find(isbn);
 
-                    if (bookIt != library->getBooks().end()) {
+                    if (book != nullptr) {
                         // Find any librarian
-                        auto librarianIt = find_if(library->getUsers().begin(), library->getUsers().end(),
-                            [](User* u) { return dynamic_cast<Librarian*>(u) != nullptr; });
+                        User* librarianUser = library->getUsers().anyLibrarian();
 
-                        if (librarianIt != library->getUsers().end()) {
-                            Librarian* librarian = dynamic_cast<Librarian*>(*librarianIt);
-                            member->returnBook(*bookIt, *librarian);
+                        if (librarianUser != nullptr) {
+                            Librarian* librarian = static_cast<Librarian*>(librarianUser);
+                            member->returnBook(library->getRecords(), book, *librarian);
                         } else {
                             cout << "No librarian available to process your request!\n";
                         }
@@ -958,8 +6387,27 @@ int main() {
                     }
                 } else if (choice == 4) {
                     // View History
-                    member->viewHistory();
+                    double fines;
+                    time_t asOf;
+                    if (library->outstandingFines(member->getUsername(), fines, asOf)) {
+                        ostringstream owed;
+                        owed << fixed << setprecision(2) << "$" << fines;
+                        cout << "Outstanding fines: " << owed.str() << " (as of " << timeToString(asOf) << ")\n";
+                    }
+                    size_t cursor = member->viewHistory(library->getRecords());
+                    while (cursor != NO_RECORD) {
+                        cout << "1. Older Loans\n2. Back\n";
+                        cout << "Enter choice: ";
+                        cin >> choice;
+                        cin.ignore();
+                        if (choice != 1) {
+                            break;
+                        }
+                        cursor = member->viewHistory(library->getRecords(), cursor);
+                    }
                 } else if (choice == 5) {
+                    browseCatalog(*member, library->getBooks());
+                } else if (choice == 6) {
                     library->logout();
                 }
             } else if (Guest* guest = dynamic_cast<Guest*>(currentUser)) {
@@ -975,6 +6423,8 @@ int main() {
                     getline(cin, query);
                     guest->searchBooks(library->getBooks(), query);
                 } else if (choice == 2) {
+                    browseCatalog(*guest, library->getBooks());
+                } else if (choice == 3) {
                     library->logout();
                 }
             }